@@ -0,0 +1,38 @@
+#ifndef SIV_FONT_PACK_H
+#define SIV_FONT_PACK_H
+
+#include <stdint.h>
+
+/* Glyphs pre-rasterised at build time by tools/mkfontpack into the generated
+   font_pack.c. Each scale has its glyphs sorted by codepoint and its kerning
+   pairs sorted by (left, right); pairs not listed kern by 0. Pixel metrics
+   are truncated exactly as SpringIntoView truncates them at runtime. */
+
+typedef struct {
+    uint16_t codepoint;
+    uint8_t w, h;
+    int16_t x_off, y_off;   // bitmap top-left relative to the pen, baseline included
+    int16_t advance;
+    uint32_t bitmap;        // offset into siv_font_pack_bitmaps, w * h bytes
+} siv_pack_glyph_t;
+
+typedef struct {
+    uint16_t left, right;
+    int16_t adjust;
+} siv_pack_kern_t;
+
+typedef struct {
+    float scale;            // as passed to siv_draw_text()
+    int16_t ascent;         // baseline offset in pixels
+    int16_t height;         // ascent - descent in pixels
+    uint32_t first_glyph, glyph_count;
+    uint32_t first_kern, kern_count;
+} siv_pack_scale_t;
+
+extern const siv_pack_scale_t siv_font_pack_scales[];
+extern const uint32_t siv_font_pack_scale_count;
+extern const siv_pack_glyph_t siv_font_pack_glyphs[];
+extern const siv_pack_kern_t siv_font_pack_kerns[];
+extern const uint8_t siv_font_pack_bitmaps[];
+
+#endif // SIV_FONT_PACK_H
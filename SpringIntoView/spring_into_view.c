@@ -1,11 +1,25 @@
 #include "spring_into_view.h"
 #include <stddef.h>
-#include "../pmm.h" // For pmm_alloc
+#include "../pmm.h" // For pmm_alloc/pmm_free
+#include "../mem.h" // For phys_to_virt/virt_to_phys
 #include "../string.h" // For memcpy, memset, strlen
 #include "../libs/stb_truetype.h"
 
 // Embedded font data
 #include "font.h"
+#include "font_pack.h"
+
+// Compile-time toggle: draw ASCII at the common scales from the build-time
+// font pack (tools/mkfontpack) instead of stb_truetype
+#ifndef SIV_FONT_PACK
+#define SIV_FONT_PACK 1
+#endif
+
+// Compile-time default for siv_enable_sdf_text(): draw scales the font pack
+// does not cover from signed distance fields
+#ifndef SIV_SDF_TEXT
+#define SIV_SDF_TEXT 1
+#endif
 
 static uint32_t* fb = 0;
 static uint32_t fb_width = 0, fb_height = 0, fb_pitch = 0, fb_bpp = 0;
@@ -13,15 +27,140 @@ static stbtt_fontinfo font_info;
 static bool font_initialized = false;
 static bool use_double_buffer = false;
 static uint32_t* backbuffer = 0;
-static inline uint32_t active_pitch_bytes(void)
+static size_t backbuffer_bytes = 0;
+
+// Damage list: half-open rectangles of the back buffer written since the last
+// present. Overlapping or touching rects are merged as they are added.
+#define SIV_MAX_DAMAGE 16
+typedef struct {
+    int x0, y0, x1, y1;
+} siv_rect_t;
+static siv_rect_t damage[SIV_MAX_DAMAGE];
+static int damage_count = 0;
+static siv_present_stats_t present_stats;
+
+/* Span kernels for one framebuffer format. dst is the first pixel of a span
+   that the caller has already clipped; colours are 0xRRGGBB and coverage is
+   0..255 per pixel. select_span_ops() picks the set for fb_bpp once;
+   surfaces always use span_ops32. */
+typedef struct {
+    void (*fill)(uint8_t* dst, uint32_t color, int n);
+    void (*copy)(uint8_t* dst, const uint32_t* src, int n);
+    void (*blend)(uint8_t* dst, uint32_t color, const uint8_t* coverage, int n);
+    void (*fill_alpha)(uint8_t* dst, uint32_t color, uint8_t alpha, int n);
+} siv_span_ops_t;
+
+// Buffer that drawing goes to: the surface set with siv_set_target(), else
+// the back buffer when enabled, else the LFB. draw_w x draw_h is its size.
+static siv_surface_t* draw_surface = 0;
+static uint8_t* draw_buf = 0;
+static uint32_t draw_pitch = 0;
+static uint32_t draw_bytespp = 0;
+static int draw_w = 0, draw_h = 0;
+
+// Half-open clip rect within the draw target; every primitive clips to it.
+static int clip_x0 = 0, clip_y0 = 0, clip_x1 = 0, clip_y1 = 0;
+
+static inline uint8_t* pixel_addr(int x, int y)
 {
-    uint32_t bytes_per_pixel = fb_bpp / 8;
-    if (use_double_buffer && backbuffer) return fb_width * bytes_per_pixel;
-    return fb_pitch;
+    return draw_buf + (size_t)y * draw_pitch + (size_t)x * draw_bytespp;
 }
 
 static inline int siv_abs(int x) { return x < 0 ? -x : x; }
 
+static inline long rect_area(const siv_rect_t* r) {
+    return (long)(r->x1 - r->x0) * (long)(r->y1 - r->y0);
+}
+
+static inline void rect_union(siv_rect_t* a, const siv_rect_t* b) {
+    if (b->x0 < a->x0) a->x0 = b->x0;
+    if (b->y0 < a->y0) a->y0 = b->y0;
+    if (b->x1 > a->x1) a->x1 = b->x1;
+    if (b->y1 > a->y1) a->y1 = b->y1;
+}
+
+static inline bool rect_touches(const siv_rect_t* a, const siv_rect_t* b) {
+    return a->x0 <= b->x1 && b->x0 <= a->x1 && a->y0 <= b->y1 && b->y0 <= a->y1;
+}
+
+/* Clip (x, y, w, h) to the clip rect. *skip_x and *skip_y get the columns and
+   rows cut off the left and top, for callers walking a source image. */
+static bool clip_box(int* x, int* y, int* w, int* h, int* skip_x, int* skip_y) {
+    int x0 = *x, y0 = *y, x1 = *x + *w, y1 = *y + *h;
+    if (x0 < clip_x0) x0 = clip_x0;
+    if (y0 < clip_y0) y0 = clip_y0;
+    if (x1 > clip_x1) x1 = clip_x1;
+    if (y1 > clip_y1) y1 = clip_y1;
+    if (x0 >= x1 || y0 >= y1) return false;
+    if (skip_x) *skip_x = x0 - *x;
+    if (skip_y) *skip_y = y0 - *y;
+    *x = x0;
+    *y = y0;
+    *w = x1 - x0;
+    *h = y1 - y0;
+    return true;
+}
+
+/* Record that (x, y, w, h) of the back buffer changed. A rect that overlaps or
+   touches an existing one absorbs it, and the grown rect is checked against
+   the rest again. When the list is full the new rect merges with whichever
+   entry grows the least. Direct drawing needs no tracking. */
+static void damage_add(int x, int y, int w, int h) {
+    if (!use_double_buffer || !backbuffer) return;
+    if (x < 0) { w += x; x = 0; }
+    if (y < 0) { h += y; y = 0; }
+    if (x + w > (int)fb_width) w = (int)fb_width - x;
+    if (y + h > (int)fb_height) h = (int)fb_height - y;
+    if (w <= 0 || h <= 0) return;
+
+    siv_rect_t r = { x, y, x + w, y + h };
+    for (int i = 0; i < damage_count; i++) {
+        const siv_rect_t* d = &damage[i];
+        if (r.x0 >= d->x0 && r.y0 >= d->y0 && r.x1 <= d->x1 && r.y1 <= d->y1) return;
+    }
+
+    for (;;) {
+        bool merged = false;
+        for (int i = 0; i < damage_count; i++) {
+            if (rect_touches(&r, &damage[i])) {
+                rect_union(&r, &damage[i]);
+                damage[i] = damage[--damage_count];
+                merged = true;
+                break;
+            }
+        }
+        if (merged) continue;
+        if (damage_count < SIV_MAX_DAMAGE) break;
+
+        int best = 0;
+        long best_growth = -1;
+        for (int i = 0; i < damage_count; i++) {
+            siv_rect_t u = damage[i];
+            rect_union(&u, &r);
+            long growth = rect_area(&u) - rect_area(&damage[i]);
+            if (best_growth < 0 || growth < best_growth) {
+                best = i;
+                best_growth = growth;
+            }
+        }
+        rect_union(&r, &damage[best]);
+        damage[best] = damage[--damage_count];
+    }
+    damage[damage_count++] = r;
+}
+
+static void cursor_lift(int x, int y, int w, int h);
+
+/* Damage from a draw call, recorded before it writes: clipped like the
+   drawing, and none for surfaces. Drawing straight to the LFB instead lifts
+   the cursor off first if the two overlap. */
+static void siv_damage(int x, int y, int w, int h) {
+    if (draw_surface) return;
+    if (!clip_box(&x, &y, &w, &h, 0, 0)) return;
+    if (use_double_buffer && backbuffer) damage_add(x, y, w, h);
+    else cursor_lift(x, y, w, h);
+}
+
 // === NEW: helpers for RGB565 format ===
 static inline uint16_t rgb888_to_565(uint32_t color) {
     uint8_t r = (color >> 16) & 0xFF;
@@ -37,6 +176,252 @@ static inline uint32_t rgb565_to_888(uint16_t c) {
     return ((uint32_t)(r << 3) << 16) | ((uint32_t)(g << 2) << 8) | (uint32_t)(b << 3);
 }
 
+/* Blending computes (s*a + d*(255-a)) / 255 per channel, rounded, as
+   ((s*a + d*(255-a) + 128) * 257) >> 16. That is exact for 8-bit inputs, the
+   sum fits in 16 bits, and the final step is a single pmulhuw in SSE2. */
+static inline uint32_t blend_channel(uint32_t s, uint32_t d, uint32_t a) {
+    return ((s * a + d * (255 - a) + 128) * 257) >> 16;
+}
+
+// Blends all four bytes, so a == 0 and a == 255 return dst and color exactly.
+static inline uint32_t blend_rgb(uint32_t dst, uint32_t color, uint8_t alpha) {
+    uint32_t out = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        out |= blend_channel((color >> shift) & 0xFF, (dst >> shift) & 0xFF, alpha) << shift;
+    }
+    return out;
+}
+
+/* SSE2 helpers. The intrinsics headers need a hosted libc, so like string.c
+   these are inline asm on GCC vector types; each handles four pixels. */
+typedef uint16_t siv_v8u16 __attribute__((vector_size(16)));
+
+static const siv_v8u16 v8_255 = { 255, 255, 255, 255, 255, 255, 255, 255 };
+static const siv_v8u16 v8_128 = { 128, 128, 128, 128, 128, 128, 128, 128 };
+static const siv_v8u16 v8_257 = { 257, 257, 257, 257, 257, 257, 257, 257 };
+
+// A colour's four bytes widened to words, twice: one lane per channel of two pixels.
+static inline siv_v8u16 widen_color(uint32_t color, uint32_t mul) {
+    siv_v8u16 v;
+    for (int i = 0; i < 8; i++) v[i] = (uint16_t)(((color >> ((i & 3) * 8)) & 0xFF) * mul);
+    return v;
+}
+
+// dst[0..3] = blend(dst, color, coverage[0..3]); src is widen_color(color, 1).
+static inline void blend4_sse2(uint32_t* dst, siv_v8u16 src, uint32_t coverage4) {
+    asm volatile(
+        "movd %[cov], %%xmm0\n\t"
+        "punpcklbw %%xmm0, %%xmm0\n\t"
+        "punpcklwd %%xmm0, %%xmm0\n\t"     // a0 x4, a1 x4, a2 x4, a3 x4
+        "pxor %%xmm7, %%xmm7\n\t"
+        "movdqa %%xmm0, %%xmm1\n\t"
+        "punpcklbw %%xmm7, %%xmm0\n\t"     // a for pixels 0-1 as words
+        "punpckhbw %%xmm7, %%xmm1\n\t"     // a for pixels 2-3
+        "movdqu (%[dst]), %%xmm2\n\t"
+        "movdqa %%xmm2, %%xmm3\n\t"
+        "punpcklbw %%xmm7, %%xmm2\n\t"
+        "punpckhbw %%xmm7, %%xmm3\n\t"
+        "movdqa %%xmm0, %%xmm4\n\t"
+        "movdqa %%xmm1, %%xmm5\n\t"
+        "pxor %[ff], %%xmm4\n\t"           // 255 - a
+        "pxor %[ff], %%xmm5\n\t"
+        "pmullw %%xmm4, %%xmm2\n\t"        // d * (255 - a)
+        "pmullw %%xmm5, %%xmm3\n\t"
+        "pmullw %[src], %%xmm0\n\t"        // s * a
+        "pmullw %[src], %%xmm1\n\t"
+        "paddw %%xmm0, %%xmm2\n\t"
+        "paddw %%xmm1, %%xmm3\n\t"
+        "paddw %[rnd], %%xmm2\n\t"
+        "paddw %[rnd], %%xmm3\n\t"
+        "pmulhuw %[m257], %%xmm2\n\t"
+        "pmulhuw %[m257], %%xmm3\n\t"
+        "packuswb %%xmm3, %%xmm2\n\t"
+        "movdqu %%xmm2, (%[dst])\n\t"
+        :
+        : [dst] "r"(dst), [cov] "r"(coverage4), [src] "x"(src),
+          [ff] "x"(v8_255), [rnd] "x"(v8_128), [m257] "x"(v8_257)
+        : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm7", "memory");
+}
+
+// dst[0..3] = blend(dst, color, alpha) with src_pre = s*alpha + 128 and inv = 255 - alpha.
+static inline void fill_alpha4_sse2(uint32_t* dst, siv_v8u16 src_pre, siv_v8u16 inv) {
+    asm volatile(
+        "pxor %%xmm7, %%xmm7\n\t"
+        "movdqu (%[dst]), %%xmm2\n\t"
+        "movdqa %%xmm2, %%xmm3\n\t"
+        "punpcklbw %%xmm7, %%xmm2\n\t"
+        "punpckhbw %%xmm7, %%xmm3\n\t"
+        "pmullw %[inv], %%xmm2\n\t"
+        "pmullw %[inv], %%xmm3\n\t"
+        "paddw %[pre], %%xmm2\n\t"
+        "paddw %[pre], %%xmm3\n\t"
+        "pmulhuw %[m257], %%xmm2\n\t"
+        "pmulhuw %[m257], %%xmm3\n\t"
+        "packuswb %%xmm3, %%xmm2\n\t"
+        "movdqu %%xmm2, (%[dst])\n\t"
+        :
+        : [dst] "r"(dst), [pre] "x"(src_pre), [inv] "x"(inv), [m257] "x"(v8_257)
+        : "xmm2", "xmm3", "xmm7", "memory");
+}
+
+void siv_blend_span(uint32_t* dst, uint32_t color, const uint8_t* coverage, int n) {
+    siv_v8u16 src = widen_color(color, 1);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        uint32_t cov4 = *(const uint32_t __attribute__((may_alias, aligned(1)))*)(coverage + i);
+        // Glyph coverage is mostly empty or solid; skip the arithmetic there.
+        if (cov4 == 0) continue;
+        if (cov4 == 0xFFFFFFFFu) {
+            dst[i] = dst[i + 1] = dst[i + 2] = dst[i + 3] = color;
+            continue;
+        }
+        blend4_sse2(dst + i, src, cov4);
+    }
+    for (; i < n; i++) {
+        uint8_t a = coverage[i];
+        if (a == 255) dst[i] = color;
+        else if (a) dst[i] = blend_rgb(dst[i], color, a);
+    }
+}
+
+// --- 32-bpp XRGB ---
+static void fill_span32(uint8_t* dst, uint32_t color, int n) {
+    memset32(dst, color, (size_t)n);
+}
+
+static void copy_span32(uint8_t* dst, const uint32_t* src, int n) {
+    memcpy(dst, src, (size_t)n * 4);
+}
+
+static void blend_span32(uint8_t* dst, uint32_t color, const uint8_t* coverage, int n) {
+    siv_blend_span((uint32_t*)dst, color, coverage, n);
+}
+
+static void fill_alpha_span32(uint8_t* dst, uint32_t color, uint8_t alpha, int n) {
+    uint32_t* p = (uint32_t*)dst;
+    // The source term is the same for every pixel: premultiply it once.
+    siv_v8u16 pre = widen_color(color, alpha) + v8_128;
+    siv_v8u16 inv = v8_255 - (uint16_t)alpha;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) fill_alpha4_sse2(p + i, pre, inv);
+    for (; i < n; i++) p[i] = blend_rgb(p[i], color, alpha);
+}
+
+// --- 24-bpp, stored as B, G, R ---
+static void fill_span24(uint8_t* dst, uint32_t color, int n) {
+    uint8_t b = color & 0xFF, g = (color >> 8) & 0xFF, r = (color >> 16) & 0xFF;
+    for (int i = 0; i < n; i++, dst += 3) {
+        dst[0] = b;
+        dst[1] = g;
+        dst[2] = r;
+    }
+}
+
+static void copy_span24(uint8_t* dst, const uint32_t* src, int n) {
+    for (int i = 0; i < n; i++, dst += 3) {
+        dst[0] = src[i] & 0xFF;
+        dst[1] = (src[i] >> 8) & 0xFF;
+        dst[2] = (src[i] >> 16) & 0xFF;
+    }
+}
+
+static void blend_span24(uint8_t* dst, uint32_t color, const uint8_t* coverage, int n) {
+    for (int i = 0; i < n; i++, dst += 3) {
+        uint8_t a = coverage[i];
+        if (a == 0) continue;
+        for (int c = 0; c < 3; c++) dst[c] = (uint8_t)blend_channel((color >> (c * 8)) & 0xFF, dst[c], a);
+    }
+}
+
+static void fill_alpha_span24(uint8_t* dst, uint32_t color, uint8_t alpha, int n) {
+    uint32_t pre[3];
+    for (int c = 0; c < 3; c++) pre[c] = ((color >> (c * 8)) & 0xFF) * alpha + 128;
+    for (int i = 0; i < n; i++, dst += 3) {
+        for (int c = 0; c < 3; c++) dst[c] = (uint8_t)(((pre[c] + dst[c] * (255u - alpha)) * 257) >> 16);
+    }
+}
+
+// --- 16-bpp RGB565 ---
+static void fill_span16(uint8_t* dst, uint32_t color, int n) {
+    uint16_t v = rgb888_to_565(color);
+    uint16_t* p = (uint16_t*)dst;
+    for (int i = 0; i < n; i++) p[i] = v;
+}
+
+static void copy_span16(uint8_t* dst, const uint32_t* src, int n) {
+    uint16_t* p = (uint16_t*)dst;
+    for (int i = 0; i < n; i++) p[i] = rgb888_to_565(src[i]);
+}
+
+static void blend_span16(uint8_t* dst, uint32_t color, const uint8_t* coverage, int n) {
+    uint16_t* p = (uint16_t*)dst;
+    uint16_t solid = rgb888_to_565(color);
+    for (int i = 0; i < n; i++) {
+        uint8_t a = coverage[i];
+        if (a == 255) p[i] = solid;
+        else if (a) p[i] = rgb888_to_565(blend_rgb(rgb565_to_888(p[i]), color, a));
+    }
+}
+
+static void fill_alpha_span16(uint8_t* dst, uint32_t color, uint8_t alpha, int n) {
+    uint16_t* p = (uint16_t*)dst;
+    for (int i = 0; i < n; i++) p[i] = rgb888_to_565(blend_rgb(rgb565_to_888(p[i]), color, alpha));
+}
+
+// Any other depth draws nothing, as before.
+static void fill_span_none(uint8_t* dst, uint32_t color, int n) { (void)dst; (void)color; (void)n; }
+static void copy_span_none(uint8_t* dst, const uint32_t* src, int n) { (void)dst; (void)src; (void)n; }
+static void blend_span_none(uint8_t* dst, uint32_t color, const uint8_t* coverage, int n) {
+    (void)dst; (void)color; (void)coverage; (void)n;
+}
+static void fill_alpha_span_none(uint8_t* dst, uint32_t color, uint8_t alpha, int n) {
+    (void)dst; (void)color; (void)alpha; (void)n;
+}
+
+static const siv_span_ops_t span_ops32 = { fill_span32, copy_span32, blend_span32, fill_alpha_span32 };
+static const siv_span_ops_t span_ops24 = { fill_span24, copy_span24, blend_span24, fill_alpha_span24 };
+static const siv_span_ops_t span_ops16 = { fill_span16, copy_span16, blend_span16, fill_alpha_span16 };
+static const siv_span_ops_t span_ops_none = { fill_span_none, copy_span_none, blend_span_none, fill_alpha_span_none };
+static const siv_span_ops_t* span = &span_ops_none;
+static const siv_span_ops_t* screen_span = &span_ops_none;
+
+static void select_span_ops(void) {
+    if (fb_bpp == 32) screen_span = &span_ops32;
+    else if (fb_bpp == 24) screen_span = &span_ops24;
+    else if (fb_bpp == 16) screen_span = &span_ops16;
+    else screen_span = &span_ops_none;
+}
+
+// Point draw_* and span at the current target and reset the clip rect to it.
+// Surfaces are always 32 bpp, whatever the framebuffer format.
+static void update_draw_target(void)
+{
+    if (draw_surface) {
+        draw_buf = (uint8_t*)draw_surface->pixels;
+        draw_bytespp = 4;
+        draw_pitch = (uint32_t)draw_surface->w * 4;
+        draw_w = draw_surface->w;
+        draw_h = draw_surface->h;
+        span = &span_ops32;
+    } else {
+        draw_bytespp = fb_bpp / 8;
+        if (use_double_buffer && backbuffer) {
+            draw_buf = (uint8_t*)backbuffer;
+            draw_pitch = fb_width * draw_bytespp;
+        } else {
+            draw_buf = (uint8_t*)fb;
+            draw_pitch = fb_pitch;
+        }
+        draw_w = (int)fb_width;
+        draw_h = (int)fb_height;
+        span = screen_span;
+    }
+    clip_x0 = 0;
+    clip_y0 = 0;
+    clip_x1 = draw_w;
+    clip_y1 = draw_h;
+}
+
 // Decode one UTF-8 codepoint and advance the input pointer.
 // Returns -1 on end-of-string. Returns U+FFFD on malformed sequences.
 static inline int siv_is_cont_byte(unsigned char b)
@@ -99,10 +484,432 @@ static int siv_utf8_decode_advance(const char** text_ptr)
     return 0xFFFD;
 }
 
+static void blend_coverage(int x, int y, const uint8_t* coverage, int w, int h, int stride, uint32_t color);
+
+/* Glyph cache: coverage bitmaps rasterised once per (codepoint, scale) into an
+   8-bit atlas. The atlas is split into three size classes of square cells;
+   a glyph takes a cell of the smallest class it fits, evicting the least
+   recently used glyph of that class when the class is full. Glyphs larger
+   than the biggest cell are drawn uncached. */
+#define SIV_ATLAS_W 512
+#define SIV_ATLAS_H 256
+#define SIV_GLYPH_SLOTS (128 + 64 + 8)
+#define SIV_GLYPH_BUCKETS 256
+
+typedef struct {
+    uint16_t cell;      // cell edge in pixels
+    uint16_t first;     // first slot index of the class
+    uint16_t count;
+    uint16_t atlas_y;   // top row of the class band
+} siv_glyph_class_t;
+
+static const siv_glyph_class_t glyph_classes[] = {
+    { 16, 0,   128, 0   },  // 4 rows of 32
+    { 32, 128, 64,  64  },  // 4 rows of 16
+    { 64, 192, 8,   192 },  // 1 row of 8
+};
+#define SIV_GLYPH_CLASSES (sizeof(glyph_classes) / sizeof(glyph_classes[0]))
+
+typedef struct {
+    int codepoint;      // -1 when the slot is free
+    float scale;
+    int16_t w, h;
+    int16_t x_off, y_off;   // top-left relative to the pen, baseline included
+    uint16_t atlas_x, atlas_y;
+    uint32_t last_used;
+    int16_t next;       // hash chain
+} siv_glyph_t;
+
+static uint8_t* glyph_atlas = 0;
+static siv_glyph_t glyph_slots[SIV_GLYPH_SLOTS];
+static int16_t glyph_buckets[SIV_GLYPH_BUCKETS];
+static uint32_t glyph_clock = 0;
+static siv_glyph_cache_stats_t glyph_stats;
+
+static inline uint32_t glyph_hash(int codepoint, float scale) {
+    union { float f; uint32_t u; } bits = { scale };
+    return ((uint32_t)codepoint * 2654435761u ^ bits.u * 40503u) % SIV_GLYPH_BUCKETS;
+}
+
+static bool glyph_cache_init(void) {
+    if (glyph_atlas) return true;
+    void* phys = pmm_alloc(SIV_ATLAS_W * SIV_ATLAS_H);
+    if (!phys) return false;
+    glyph_atlas = (uint8_t*)phys_to_virt((uint64_t)phys);
+    for (int i = 0; i < SIV_GLYPH_BUCKETS; i++) glyph_buckets[i] = -1;
+    for (size_t c = 0; c < SIV_GLYPH_CLASSES; c++) {
+        const siv_glyph_class_t* gc = &glyph_classes[c];
+        int per_row = SIV_ATLAS_W / gc->cell;
+        for (int i = 0; i < gc->count; i++) {
+            siv_glyph_t* g = &glyph_slots[gc->first + i];
+            g->codepoint = -1;
+            g->atlas_x = (uint16_t)((i % per_row) * gc->cell);
+            g->atlas_y = (uint16_t)(gc->atlas_y + (i / per_row) * gc->cell);
+        }
+    }
+    return true;
+}
+
+static void glyph_unlink(siv_glyph_t* g) {
+    int16_t* link = &glyph_buckets[glyph_hash(g->codepoint, g->scale)];
+    while (*link >= 0) {
+        siv_glyph_t* cur = &glyph_slots[*link];
+        if (cur == g) {
+            *link = g->next;
+            break;
+        }
+        link = &cur->next;
+    }
+    g->codepoint = -1;
+}
+
+/* Cached glyph for (codepoint, scale), rasterising it on a miss. NULL means
+   the glyph does not fit a cell (or there is no atlas) and must be drawn
+   directly. */
+static const siv_glyph_t* glyph_lookup(int codepoint, float scale) {
+    if (!glyph_cache_init()) return NULL;
+
+    uint32_t bucket = glyph_hash(codepoint, scale);
+    for (int16_t i = glyph_buckets[bucket]; i >= 0; i = glyph_slots[i].next) {
+        siv_glyph_t* g = &glyph_slots[i];
+        if (g->codepoint == codepoint && g->scale == scale) {
+            g->last_used = ++glyph_clock;
+            glyph_stats.hits++;
+            return g;
+        }
+    }
+    glyph_stats.misses++;
+
+    float font_scale = stbtt_ScaleForPixelHeight(&font_info, 16.0f * scale);
+    int ix0, iy0, ix1, iy1;
+    stbtt_GetCodepointBitmapBox(&font_info, codepoint, font_scale, font_scale, &ix0, &iy0, &ix1, &iy1);
+    int w = ix1 - ix0, h = iy1 - iy0;
+    if (w < 0 || h < 0) w = h = 0;
+
+    const siv_glyph_class_t* gc = NULL;
+    for (size_t c = 0; c < SIV_GLYPH_CLASSES; c++) {
+        if (w <= glyph_classes[c].cell && h <= glyph_classes[c].cell) {
+            gc = &glyph_classes[c];
+            break;
+        }
+    }
+    if (!gc) {
+        glyph_stats.uncached++;
+        return NULL;
+    }
+
+    siv_glyph_t* victim = &glyph_slots[gc->first];
+    for (int i = 0; i < gc->count && victim->codepoint >= 0; i++) {
+        siv_glyph_t* g = &glyph_slots[gc->first + i];
+        if (g->codepoint < 0 || g->last_used < victim->last_used) victim = g;
+    }
+    if (victim->codepoint >= 0) {
+        glyph_unlink(victim);
+        glyph_stats.evictions++;
+    } else {
+        glyph_stats.entries++;
+    }
+
+    int ascent, descent, lineGap;
+    stbtt_GetFontVMetrics(&font_info, &ascent, &descent, &lineGap);
+    victim->codepoint = codepoint;
+    victim->scale = scale;
+    victim->w = (int16_t)w;
+    victim->h = (int16_t)h;
+    victim->x_off = (int16_t)ix0;
+    victim->y_off = (int16_t)((int)(ascent * font_scale) + iy0);
+    victim->last_used = ++glyph_clock;
+    if (w > 0 && h > 0) {
+        stbtt_MakeCodepointBitmap(&font_info, glyph_atlas + (size_t)victim->atlas_y * SIV_ATLAS_W + victim->atlas_x,
+                                  w, h, SIV_ATLAS_W, font_scale, font_scale, codepoint);
+    }
+    victim->next = glyph_buckets[bucket];
+    glyph_buckets[bucket] = (int16_t)(victim - glyph_slots);
+    return victim;
+}
+
+void siv_get_glyph_cache_stats(siv_glyph_cache_stats_t* stats) {
+    if (stats) *stats = glyph_stats;
+}
+
+/* Font pack lookups. Codepoints and scales the pack covers are drawn and
+   measured straight from its tables; everything else goes to stb_truetype. */
+static const siv_pack_scale_t* pack_scale(float scale) {
+#if SIV_FONT_PACK
+    for (uint32_t i = 0; i < siv_font_pack_scale_count; i++) {
+        if (siv_font_pack_scales[i].scale == scale) return &siv_font_pack_scales[i];
+    }
+#else
+    (void)scale;
+#endif
+    return NULL;
+}
+
+static const siv_pack_glyph_t* pack_glyph(const siv_pack_scale_t* ps, int codepoint) {
+#if SIV_FONT_PACK
+    if (!ps) return NULL;
+    const siv_pack_glyph_t* glyphs = &siv_font_pack_glyphs[ps->first_glyph];
+    uint32_t lo = 0, hi = ps->glyph_count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (glyphs[mid].codepoint < codepoint) lo = mid + 1;
+        else if (glyphs[mid].codepoint > codepoint) hi = mid;
+        else return &glyphs[mid];
+    }
+#else
+    (void)ps;
+    (void)codepoint;
+#endif
+    return NULL;
+}
+
+static const uint8_t* pack_bitmap(const siv_pack_glyph_t* g) {
+#if SIV_FONT_PACK
+    return siv_font_pack_bitmaps + g->bitmap;
+#else
+    (void)g;
+    return NULL;
+#endif
+}
+
+// Kerning between two packed glyphs; pairs missing from the pack kern by 0.
+static int pack_kern(const siv_pack_scale_t* ps, int left, int right) {
+#if SIV_FONT_PACK
+    const siv_pack_kern_t* kerns = &siv_font_pack_kerns[ps->first_kern];
+    uint32_t key = ((uint32_t)left << 16) | (uint32_t)right;
+    uint32_t lo = 0, hi = ps->kern_count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        uint32_t k = ((uint32_t)kerns[mid].left << 16) | kerns[mid].right;
+        if (k < key) lo = mid + 1;
+        else if (k > key) hi = mid;
+        else return kerns[mid].adjust;
+    }
+#else
+    (void)ps;
+    (void)left;
+    (void)right;
+#endif
+    return 0;
+}
+
+// Pen advance for codepoint, plus kerning against prev_cp when that is >= 0.
+static int text_advance(const siv_pack_scale_t* ps, float scale, int prev_cp, int codepoint) {
+    const siv_pack_glyph_t* g = pack_glyph(ps, codepoint);
+    bool kern_packed = g && prev_cp >= 0 && pack_glyph(ps, prev_cp);
+    int advance = 0;
+    if (g) {
+        advance = g->advance;
+    } else if (font_initialized) {
+        int advanceWidth, leftSideBearing;
+        stbtt_GetCodepointHMetrics(&font_info, codepoint, &advanceWidth, &leftSideBearing);
+        advance = (int)(advanceWidth * stbtt_ScaleForPixelHeight(&font_info, 16.0f * scale));
+    }
+    if (prev_cp >= 0) {
+        if (kern_packed) {
+            advance += pack_kern(ps, prev_cp, codepoint);
+        } else if (font_initialized) {
+            float font_scale = stbtt_ScaleForPixelHeight(&font_info, 16.0f * scale);
+            advance += (int)(stbtt_GetCodepointKernAdvance(&font_info, prev_cp, codepoint) * font_scale);
+        }
+    }
+    return advance;
+}
+
+// Baseline offset and line height in pixels.
+static void text_vmetrics(float scale, int* ascent_px, int* height_px) {
+    const siv_pack_scale_t* ps = pack_scale(scale);
+    if (ps) {
+        *ascent_px = ps->ascent;
+        *height_px = ps->height;
+        return;
+    }
+    *ascent_px = *height_px = 0;
+    if (!font_initialized) return;
+    float font_scale = stbtt_ScaleForPixelHeight(&font_info, 16.0f * scale);
+    int ascent, descent, lineGap;
+    stbtt_GetFontVMetrics(&font_info, &ascent, &descent, &lineGap);
+    *ascent_px = (int)(ascent * font_scale);
+    *height_px = (int)((ascent - descent) * font_scale);
+}
+
+/* SDF text: each codepoint is turned into a signed distance field once, at a
+   32 px line height, and shelf-packed into its own atlas. Any scale the font
+   pack does not cover samples that field bilinearly and maps distance to
+   coverage with a smoothstep one target pixel wide, so a new scale costs no
+   rasterisation and no atlas space. Codepoints whose field does not fit the
+   atlas use the glyph cache instead. */
+#define SIV_SDF_LINE_PX 32.0f
+#define SIV_SDF_PADDING 4           // field pixels around the outline
+#define SIV_SDF_ONEDGE 128
+#define SIV_SDF_DIST_SCALE 32.0f    // field value per field pixel of distance
+#define SIV_SDF_ATLAS_W 512
+#define SIV_SDF_ATLAS_H 256
+#define SIV_SDF_SLOTS 256           // open-addressed by codepoint
+#define SIV_SDF_ROW 256             // coverage computed per row in chunks of this
+
+typedef struct {
+    int codepoint;          // -1 when the slot is free
+    bool in_atlas;          // false: empty glyph, or no room for the field
+    int16_t w, h;
+    int16_t x_off, y_off;   // field top-left relative to the pen at SIV_SDF_LINE_PX
+    uint16_t atlas_x, atlas_y;
+} siv_sdf_glyph_t;
+
+static bool sdf_text_enabled = SIV_SDF_TEXT;
+static uint8_t* sdf_atlas = 0;
+static siv_sdf_glyph_t sdf_glyphs[SIV_SDF_SLOTS];
+static int sdf_glyph_count = 0;
+static int sdf_shelf_x = 0, sdf_shelf_y = 0, sdf_shelf_h = 0;
+static float sdf_font_scale = 0;
+
+void siv_enable_sdf_text(bool enable) {
+    sdf_text_enabled = enable;
+}
+
+static bool sdf_init(void) {
+    if (sdf_atlas) return true;
+    void* phys = pmm_alloc(SIV_SDF_ATLAS_W * SIV_SDF_ATLAS_H);
+    if (!phys) return false;
+    sdf_atlas = (uint8_t*)phys_to_virt((uint64_t)phys);
+    for (int i = 0; i < SIV_SDF_SLOTS; i++) sdf_glyphs[i].codepoint = -1;
+    sdf_font_scale = stbtt_ScaleForPixelHeight(&font_info, SIV_SDF_LINE_PX);
+    return true;
+}
+
+// Field for codepoint, generated on first use; NULL when the table is full.
+static const siv_sdf_glyph_t* sdf_lookup(int codepoint) {
+    if (!sdf_init()) return NULL;
+
+    uint32_t i = ((uint32_t)codepoint * 2654435761u) % SIV_SDF_SLOTS;
+    while (sdf_glyphs[i].codepoint >= 0) {
+        if (sdf_glyphs[i].codepoint == codepoint) return &sdf_glyphs[i];
+        i = (i + 1) % SIV_SDF_SLOTS;
+    }
+    // Keep one slot free so probing always terminates.
+    if (sdf_glyph_count == SIV_SDF_SLOTS - 1) return NULL;
+
+    siv_sdf_glyph_t* g = &sdf_glyphs[i];
+    g->codepoint = codepoint;
+    g->in_atlas = false;
+    sdf_glyph_count++;
+    glyph_stats.sdf_glyphs++;
+
+    int w, h, xoff, yoff;
+    unsigned char* field = stbtt_GetCodepointSDF(&font_info, sdf_font_scale, codepoint, SIV_SDF_PADDING,
+                                                 SIV_SDF_ONEDGE, SIV_SDF_DIST_SCALE, &w, &h, &xoff, &yoff);
+    if (!field) return g;   // nothing to draw, e.g. a space
+
+    if (sdf_shelf_x + w > SIV_SDF_ATLAS_W) {
+        sdf_shelf_y += sdf_shelf_h;
+        sdf_shelf_x = 0;
+        sdf_shelf_h = 0;
+    }
+    if (w <= SIV_SDF_ATLAS_W && sdf_shelf_y + h <= SIV_SDF_ATLAS_H) {
+        g->in_atlas = true;
+        g->w = (int16_t)w;
+        g->h = (int16_t)h;
+        g->x_off = (int16_t)xoff;
+        g->y_off = (int16_t)yoff;
+        g->atlas_x = (uint16_t)sdf_shelf_x;
+        g->atlas_y = (uint16_t)sdf_shelf_y;
+        for (int row = 0; row < h; row++) {
+            memcpy(sdf_atlas + (size_t)(sdf_shelf_y + row) * SIV_SDF_ATLAS_W + sdf_shelf_x, field + (size_t)row * w, (size_t)w);
+        }
+        sdf_shelf_x += w;
+        if (h > sdf_shelf_h) sdf_shelf_h = h;
+    } else {
+        // Atlas full: forget the glyph so the bitmap paths draw it.
+        g->codepoint = -1;
+        sdf_glyph_count--;
+        glyph_stats.sdf_glyphs--;
+        stbtt_FreeSDF(field, NULL);
+        return NULL;
+    }
+    stbtt_FreeSDF(field, NULL);
+    return g;
+}
+
+static inline int floor_int(float v) {
+    int i = (int)v;
+    return (v < (float)i) ? i - 1 : i;
+}
+
+static inline float sdf_texel(const siv_sdf_glyph_t* g, int u, int v) {
+    if (u < 0 || v < 0 || u >= g->w || v >= g->h) return 0.0f;
+    return sdf_atlas[(size_t)(g->atlas_y + v) * SIV_SDF_ATLAS_W + g->atlas_x + u];
+}
+
+static void sdf_draw(int x, int y, const siv_sdf_glyph_t* g, float scale, uint32_t color) {
+    float target_scale = stbtt_ScaleForPixelHeight(&font_info, 16.0f * scale);
+    float k = target_scale / sdf_font_scale;    // target pixels per field pixel
+    int x0 = floor_int(g->x_off * k), y0 = floor_int(g->y_off * k);
+    int x1 = -floor_int(-(g->x_off + g->w) * k), y1 = -floor_int(-(g->y_off + g->h) * k);
+    int ascent, line_height;
+    text_vmetrics(scale, &ascent, &line_height);
+    int left = x + x0, top = y + ascent + y0;
+    siv_damage(left, top, x1 - x0, y1 - y0);
+
+    // Field value per target pixel of distance, and the origin of the sample grid.
+    float per_px = SIV_SDF_DIST_SCALE / k;
+    float inv_k = 1.0f / k;
+    uint8_t coverage[SIV_SDF_ROW];
+    for (int ty = y0; ty < y1; ty++) {
+        int screen_y = y + ascent + ty;
+        if (screen_y < clip_y0 || screen_y >= clip_y1) continue;
+        float fv = (ty + 0.5f) * inv_k - g->y_off - 0.5f;
+        int iv = floor_int(fv);
+        float wv = fv - iv;
+        for (int cx = x0; cx < x1; cx += SIV_SDF_ROW) {
+            int n = x1 - cx < SIV_SDF_ROW ? x1 - cx : SIV_SDF_ROW;
+            for (int i = 0; i < n; i++) {
+                float fu = (cx + i + 0.5f) * inv_k - g->x_off - 0.5f;
+                int iu = floor_int(fu);
+                float wu = fu - iu;
+                float top_row = sdf_texel(g, iu, iv) * (1 - wu) + sdf_texel(g, iu + 1, iv) * wu;
+                float bottom_row = sdf_texel(g, iu, iv + 1) * (1 - wu) + sdf_texel(g, iu + 1, iv + 1) * wu;
+                float d = top_row * (1 - wv) + bottom_row * wv;
+                // Signed distance in target pixels, smoothstepped over one pixel.
+                float t = (d - SIV_SDF_ONEDGE) / per_px + 0.5f;
+                if (t <= 0) t = 0;
+                else if (t >= 1) t = 1;
+                coverage[i] = (uint8_t)(t * t * (3 - 2 * t) * 255.0f + 0.5f);
+            }
+            blend_coverage(x + cx, screen_y, coverage, n, 1, n, color);
+        }
+    }
+}
+
 static void siv_draw_codepoint(int x, int y, int codepoint, float scale, uint32_t color)
 {
+    const siv_pack_glyph_t* pg = pack_glyph(pack_scale(scale), codepoint);
+    if (pg) {
+        if (pg->w > 0 && pg->h > 0) {
+            siv_damage(x + pg->x_off, y + pg->y_off, pg->w, pg->h);
+            blend_coverage(x + pg->x_off, y + pg->y_off, pack_bitmap(pg), pg->w, pg->h, pg->w, color);
+        }
+        return;
+    }
     if (!font_initialized) return;
 
+    if (sdf_text_enabled) {
+        const siv_sdf_glyph_t* sg = sdf_lookup(codepoint);
+        if (sg) {
+            if (sg->in_atlas) sdf_draw(x, y, sg, scale, color);
+            return;
+        }
+    }
+
+    const siv_glyph_t* g = glyph_lookup(codepoint, scale);
+    if (g) {
+        if (g->w > 0 && g->h > 0) {
+            siv_damage(x + g->x_off, y + g->y_off, g->w, g->h);
+            blend_coverage(x + g->x_off, y + g->y_off, glyph_atlas + (size_t)g->atlas_y * SIV_ATLAS_W + g->atlas_x,
+                           g->w, g->h, SIV_ATLAS_W, color);
+        }
+        return;
+    }
+
     int ascent, descent, lineGap;
     stbtt_GetFontVMetrics(&font_info, &ascent, &descent, &lineGap);
     float font_scale = stbtt_ScaleForPixelHeight(&font_info, 16.0f * scale);
@@ -111,13 +918,9 @@ static void siv_draw_codepoint(int x, int y, int codepoint, float scale, uint32_
     int bitmap_w, bitmap_h, xoff, yoff;
     unsigned char* bitmap = stbtt_GetCodepointBitmap(&font_info, font_scale, font_scale, codepoint, &bitmap_w, &bitmap_h, &xoff, &yoff);
     if (bitmap) {
-        for (int row = 0; row < bitmap_h; ++row) {
-            for (int col = 0; col < bitmap_w; ++col) {
-                uint8_t alpha = bitmap[row * bitmap_w + col];
-                siv_put_pixel_alpha(x + xoff + col, y + ascent + yoff + row, color, alpha);
-            }
-        }
-        // Keep glyph bitmap to avoid re-allocations that can fail; intentionally not freed
+        siv_damage(x + xoff, y + ascent + yoff, bitmap_w, bitmap_h);
+        blend_coverage(x + xoff, y + ascent + yoff, bitmap, bitmap_w, bitmap_h, bitmap_w, color);
+        stbtt_FreeBitmap(bitmap, NULL);
     }
 }
 
@@ -126,13 +929,9 @@ static inline int siv_is_block_element(int cp)
     return (cp >= 0x2580 && cp <= 0x259F);
 }
 
-static void siv_draw_block_element(int x, int y, float scale, uint32_t color, int cp, int cell_w, int cell_h)
+static void siv_draw_block_element(int x, int y, int ascent, uint32_t color, int cp, int cell_w, int cell_h)
 {
     // Align cell to the same baseline convention as glyph bitmaps
-    int ascent, descent, lineGap;
-    float font_scale = stbtt_ScaleForPixelHeight(&font_info, 16.0f * scale);
-    stbtt_GetFontVMetrics(&font_info, &ascent, &descent, &lineGap);
-    ascent = (int)(ascent * font_scale);
     int top = y + ascent - cell_h;
 
     // Common halves
@@ -189,142 +988,317 @@ static void siv_draw_block_element(int x, int y, float scale, uint32_t color, in
     // Fallback: draw nothing if unknown
 }
 
+/* Cursor plane: a small ARGB sprite drawn straight into the framebuffer on top
+   of whatever was presented. The pixels it covers are saved first and put back
+   before it moves, so cursor motion never touches the back buffer or the
+   scene. The sprite is converted to the framebuffer format when set. */
+static struct {
+    bool visible;
+    bool drawn;             // sprite is on screen and under[] holds saved
+    int x, y;               // hotspot position
+    int w, h, hot_x, hot_y;
+    siv_rect_t saved;       // framebuffer area held in under[]
+    uint32_t argb[SIV_CURSOR_MAX * SIV_CURSOR_MAX];
+    uint8_t native[SIV_CURSOR_MAX * SIV_CURSOR_MAX * 4];
+    uint8_t under[SIV_CURSOR_MAX * SIV_CURSOR_MAX * 4];
+} cursor;
+
+static inline uint8_t* fb_addr(int x, int y)
+{
+    return (uint8_t*)fb + (size_t)y * fb_pitch + (size_t)x * (fb_bpp / 8);
+}
+
+// Convert the opaque sprite pixels to framebuffer bytes
+static void cursor_prerender(void)
+{
+    uint32_t bytespp = fb_bpp / 8;
+    for (int i = 0; i < cursor.w * cursor.h; i++) {
+        screen_span->fill(cursor.native + (size_t)i * bytespp, cursor.argb[i] & 0x00FFFFFF, 1);
+    }
+}
+
+static void cursor_restore(void)
+{
+    if (!cursor.drawn) return;
+    const siv_rect_t* r = &cursor.saved;
+    size_t row_bytes = (size_t)(r->x1 - r->x0) * (fb_bpp / 8);
+    const uint8_t* src = cursor.under;
+    for (int y = r->y0; y < r->y1; y++) {
+        memcpy(fb_addr(r->x0, y), src, row_bytes);
+        src += row_bytes;
+    }
+    cursor.drawn = false;
+}
+
+static void cursor_paint(void)
+{
+    if (!cursor.visible || cursor.w == 0 || !fb || screen_span == &span_ops_none) return;
+    int left = cursor.x - cursor.hot_x, top = cursor.y - cursor.hot_y;
+    siv_rect_t r = { left, top, left + cursor.w, top + cursor.h };
+    if (r.x0 < 0) r.x0 = 0;
+    if (r.y0 < 0) r.y0 = 0;
+    if (r.x1 > (int)fb_width) r.x1 = (int)fb_width;
+    if (r.y1 > (int)fb_height) r.y1 = (int)fb_height;
+    if (r.x0 >= r.x1 || r.y0 >= r.y1) return;
+
+    uint32_t bytespp = fb_bpp / 8;
+    size_t row_bytes = (size_t)(r.x1 - r.x0) * bytespp;
+    uint8_t* save = cursor.under;
+    for (int y = r.y0; y < r.y1; y++) {
+        uint8_t* dst = fb_addr(r.x0, y);
+        memcpy(save, dst, row_bytes);
+        save += row_bytes;
+        int i = (y - top) * cursor.w + (r.x0 - left);
+        for (int x = r.x0; x < r.x1; x++, i++, dst += bytespp) {
+            uint32_t a = cursor.argb[i] >> 24;
+            if (a == 255) {
+                memcpy(dst, cursor.native + (size_t)i * bytespp, bytespp);
+            } else if (a != 0) {
+                screen_span->fill_alpha(dst, cursor.argb[i] & 0x00FFFFFF, (uint8_t)a, 1);
+            }
+        }
+    }
+    cursor.saved = r;
+    cursor.drawn = true;
+}
+
+// Take the cursor off the screen if (x, y, w, h) overlaps it; the next
+// siv_present() or move puts it back.
+static void cursor_lift(int x, int y, int w, int h)
+{
+    const siv_rect_t* c = &cursor.saved;
+    if (cursor.drawn && x < c->x1 && c->x0 < x + w && y < c->y1 && c->y0 < y + h) cursor_restore();
+}
+
+void siv_cursor_set_sprite(const uint32_t* argb, int w, int h, int hot_x, int hot_y) {
+    cursor_restore();
+    if (w < 0 || h < 0 || w > SIV_CURSOR_MAX || h > SIV_CURSOR_MAX) w = h = 0;
+    cursor.w = w;
+    cursor.h = h;
+    cursor.hot_x = hot_x;
+    cursor.hot_y = hot_y;
+    memcpy(cursor.argb, argb, (size_t)w * (size_t)h * 4);
+    cursor_prerender();
+    cursor_paint();
+}
+
+void siv_cursor_move(int x, int y) {
+    if (x == cursor.x && y == cursor.y) return;
+    cursor_restore();
+    cursor.x = x;
+    cursor.y = y;
+    cursor_paint();
+}
+
+void siv_cursor_show(bool show) {
+    if (show == cursor.visible) return;
+    cursor.visible = show;
+    if (show) cursor_paint();
+    else cursor_restore();
+}
+
 void siv_init(uint32_t width, uint32_t height, uint32_t pitch, uint32_t bpp, void* framebuffer) {
+    cursor.drawn = false;
     fb = (uint32_t*)framebuffer;
     fb_width = width;
     fb_height = height;
     fb_pitch = pitch;
     fb_bpp = bpp;
+    select_span_ops();
+    update_draw_target();
+    cursor_prerender();
     // allocate double buffer lazily when enabled
-    use_double_buffer = false;
-    backbuffer = 0;
+    siv_enable_double_buffer(false);
 }
 
 void siv_enable_double_buffer(bool enable) {
     if (enable == use_double_buffer) return;
     use_double_buffer = enable;
+    damage_count = 0;
     if (use_double_buffer) {
-        // allocate backbuffer using pmm if available; fallback to simple kmalloc-like via pmm
-        size_t total_bytes = (size_t)fb_height * fb_pitch;
-        backbuffer = (uint32_t*)pmm_alloc(total_bytes);
+        // allocate backbuffer as physically contiguous pages from the PMM
+        backbuffer_bytes = (size_t)fb_height * fb_pitch;
+        void* phys = pmm_alloc(backbuffer_bytes);
+        backbuffer = phys ? (uint32_t*)phys_to_virt((uint64_t)phys) : 0;
         if (!backbuffer) {
             use_double_buffer = false;
+        } else {
+            // Nothing has been presented from this buffer yet.
+            damage_add(0, 0, (int)fb_width, (int)fb_height);
         }
     } else {
         if (backbuffer) {
-            // We do not free backbuffer to keep complexity low; memory is small in QEMU tests
+            pmm_free((void*)virt_to_phys(backbuffer), backbuffer_bytes);
             backbuffer = 0;
         }
     }
+    update_draw_target();
 }
 
 void siv_present(void) {
-    if (!use_double_buffer || !backbuffer) return;
-    // copy by rows to respect pitch
-    uint8_t* dst = (uint8_t*)fb;
-    uint8_t* src = (uint8_t*)backbuffer;
-    size_t row_bytes = (size_t)fb_width * (fb_bpp / 8);
-    for (uint32_t y = 0; y < fb_height; ++y) {
-        // memcpy available from string.h
-        memcpy(dst, src, row_bytes);
-        dst += fb_pitch;
-        src += row_bytes;
+    if (!use_double_buffer || !backbuffer) {
+        // The frame went straight to the LFB; redraw a cursor it lifted.
+        if (!cursor.drawn) cursor_paint();
+        return;
+    }
+    // copy each damaged rect by rows to respect pitch
+    size_t bytes_per_pixel = fb_bpp / 8;
+    size_t src_pitch = (size_t)fb_width * bytes_per_pixel;
+    uint64_t bytes = 0;
+    // Lift the cursor off the screen if the copy would land under it
+    bool cursor_hit = false;
+    for (int i = 0; cursor.drawn && i < damage_count; ++i) {
+        const siv_rect_t* r = &damage[i];
+        const siv_rect_t* c = &cursor.saved;
+        if (r->x0 < c->x1 && c->x0 < r->x1 && r->y0 < c->y1 && c->y0 < r->y1) cursor_hit = true;
+    }
+    if (cursor_hit) cursor_restore();
+    for (int i = 0; i < damage_count; ++i) {
+        const siv_rect_t* r = &damage[i];
+        size_t row_bytes = (size_t)(r->x1 - r->x0) * bytes_per_pixel;
+        uint8_t* dst = (uint8_t*)fb + (size_t)r->y0 * fb_pitch + (size_t)r->x0 * bytes_per_pixel;
+        uint8_t* src = (uint8_t*)backbuffer + (size_t)r->y0 * src_pitch + (size_t)r->x0 * bytes_per_pixel;
+        for (int y = r->y0; y < r->y1; ++y) {
+            memcpy(dst, src, row_bytes);
+            dst += fb_pitch;
+            src += src_pitch;
+        }
+        bytes += (uint64_t)row_bytes * (uint64_t)(r->y1 - r->y0);
+    }
+    if (cursor_hit) cursor_paint();
+    present_stats.frames++;
+    present_stats.last_bytes = bytes;
+    present_stats.total_bytes += bytes;
+    present_stats.last_rects = (uint32_t)damage_count;
+    damage_count = 0;
+}
+
+void siv_mark_dirty(int x, int y, int w, int h) {
+    damage_add(x, y, w, h);
+}
+
+bool siv_surface_create(siv_surface_t* surface, int w, int h) {
+    surface->pixels = 0;
+    surface->w = 0;
+    surface->h = 0;
+    if (w <= 0 || h <= 0) return false;
+    void* phys = pmm_alloc((size_t)w * (size_t)h * 4);
+    if (!phys) return false;
+    surface->pixels = (uint32_t*)phys_to_virt((uint64_t)phys);
+    surface->w = w;
+    surface->h = h;
+    return true;
+}
+
+void siv_surface_destroy(siv_surface_t* surface) {
+    if (!surface->pixels) return;
+    if (surface == draw_surface) siv_set_target(0);
+    pmm_free((void*)virt_to_phys(surface->pixels), (size_t)surface->w * (size_t)surface->h * 4);
+    surface->pixels = 0;
+    surface->w = 0;
+    surface->h = 0;
+}
+
+void siv_set_target(siv_surface_t* surface) {
+    draw_surface = (surface && surface->pixels) ? surface : 0;
+    update_draw_target();
+}
+
+void siv_set_clip(int x, int y, int w, int h) {
+    clip_x0 = 0;
+    clip_y0 = 0;
+    clip_x1 = draw_w;
+    clip_y1 = draw_h;
+    if (!clip_box(&x, &y, &w, &h, 0, 0)) {
+        clip_x1 = clip_y1 = 0;
+        return;
     }
+    clip_x0 = x;
+    clip_y0 = y;
+    clip_x1 = x + w;
+    clip_y1 = y + h;
+}
+
+void siv_reset_clip(void) {
+    clip_x0 = 0;
+    clip_y0 = 0;
+    clip_x1 = draw_w;
+    clip_y1 = draw_h;
+}
+
+void siv_get_present_stats(siv_present_stats_t* stats) {
+    if (stats) *stats = present_stats;
 }
 
+static void layout_cache_reset(void);
+
 bool siv_init_font(void) {
     if (stbtt_InitFont(&font_info, RobotoMono_Regular_ttf, stbtt_GetFontOffsetForIndex(RobotoMono_Regular_ttf, 0))) {
         font_initialized = true;
+        // Layouts shaped without the font may have fallen back to zero metrics.
+        layout_cache_reset();
         return true;
     }
     return false;
 }
 
-void siv_put_pixel(int x, int y, uint32_t color) {
-    if (x < 0 || y < 0 || x >= (int)fb_width || y >= (int)fb_height) return;
+/* Pixel and span writers used by every primitive; callers record the damage. */
+static void write_pixel(int x, int y, uint32_t color) {
+    if (x < clip_x0 || y < clip_y0 || x >= clip_x1 || y >= clip_y1) return;
+    span->fill(pixel_addr(x, y), color, 1);
+}
+
+static void blend_pixel(int x, int y, uint32_t color, uint8_t alpha) {
+    if (x < clip_x0 || y < clip_y0 || x >= clip_x1 || y >= clip_y1) return;
+    span->blend(pixel_addr(x, y), color, &alpha, 1);
+}
 
-    uint8_t* fb_byte_ptr = (uint8_t*)(use_double_buffer && backbuffer ? (void*)backbuffer : (void*)fb);
-    uint32_t offset = y * active_pitch_bytes() + x * (fb_bpp / 8);
+// Fill pixels x0..x1 (inclusive, either order) of row y.
+static void fill_hspan(int x0, int x1, int y, uint32_t color) {
+    if (x0 > x1) { int t = x0; x0 = x1; x1 = t; }
+    if (y < clip_y0 || y >= clip_y1) return;
+    if (x0 < clip_x0) x0 = clip_x0;
+    if (x1 >= clip_x1) x1 = clip_x1 - 1;
+    if (x0 > x1) return;
+    span->fill(pixel_addr(x0, y), color, x1 - x0 + 1);
+}
 
-    if (fb_bpp == 32) {
-        *((uint32_t*)(fb_byte_ptr + offset)) = color;
-    } else if (fb_bpp == 24) {
-        // 24-bpp: store as BGR
-        fb_byte_ptr[offset + 0] = color & 0xFF;        // B
-        fb_byte_ptr[offset + 1] = (color >> 8) & 0xFF; // G
-        fb_byte_ptr[offset + 2] = (color >> 16) & 0xFF; // R
-    } else if (fb_bpp == 16) {
-        *((uint16_t*)(fb_byte_ptr + offset)) = rgb888_to_565(color);
+// Blend a w x h coverage bitmap (stride bytes per row) with its top-left at (x, y).
+static void blend_coverage(int x, int y, const uint8_t* coverage, int w, int h, int stride, uint32_t color) {
+    int skip_x, skip_y;
+    if (!clip_box(&x, &y, &w, &h, &skip_x, &skip_y)) return;
+    coverage += (long)skip_y * stride + skip_x;
+
+    uint8_t* row = pixel_addr(x, y);
+    for (int i = 0; i < h; i++) {
+        span->blend(row, color, coverage, w);
+        row += draw_pitch;
+        coverage += stride;
     }
 }
 
+void siv_put_pixel(int x, int y, uint32_t color) {
+    siv_damage(x, y, 1, 1);
+    write_pixel(x, y, color);
+}
+
 uint32_t siv_get_pixel(int x, int y) {
-    if (x < 0 || y < 0 || x >= (int)fb_width || y >= (int)fb_height) return 0;
-
-    uint8_t* fb_byte_ptr = (uint8_t*)(use_double_buffer && backbuffer ? (void*)backbuffer : (void*)fb);
-    uint32_t offset = y * active_pitch_bytes() + x * (fb_bpp / 8);
-
-    if (fb_bpp == 32) {
-        return *((uint32_t*)(fb_byte_ptr + offset));
-    } else if (fb_bpp == 24) {
-        uint8_t b = fb_byte_ptr[offset + 0];
-        uint8_t g = fb_byte_ptr[offset + 1];
-        uint8_t r = fb_byte_ptr[offset + 2];
-        return (r << 16) | (g << 8) | b;
-    } else if (fb_bpp == 16) {
-        uint16_t c = *((uint16_t*)(fb_byte_ptr + offset));
-        return rgb565_to_888(c);
+    if (x < 0 || y < 0 || x >= draw_w || y >= draw_h) return 0;
+
+    uint8_t* p = pixel_addr(x, y);
+    if (draw_bytespp == 4) {
+        return *((uint32_t*)p);
+    } else if (draw_bytespp == 3) {
+        return ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+    } else if (draw_bytespp == 2) {
+        return rgb565_to_888(*((uint16_t*)p));
     }
     return 0;
 }
 
-// Alpha blend a pixel
 void siv_put_pixel_alpha(int x, int y, uint32_t color, uint8_t alpha) {
-    if (x < 0 || y < 0 || x >= (int)fb_width || y >= (int)fb_height) return;
-    if (alpha == 255) {
-        siv_put_pixel(x, y, color);
-        return;
-    }
-    if (alpha == 0) return;
-
-    uint8_t* fb_byte_ptr = (uint8_t*)(use_double_buffer && backbuffer ? (void*)backbuffer : (void*)fb);
-    uint32_t offset = y * active_pitch_bytes() + x * (fb_bpp / 8);
-
-    uint32_t dst;
-    if (fb_bpp == 32) {
-        dst = *((uint32_t*)(fb_byte_ptr + offset));
-    } else if (fb_bpp == 24) {
-        uint8_t b = fb_byte_ptr[offset + 0];
-        uint8_t g = fb_byte_ptr[offset + 1];
-        uint8_t r = fb_byte_ptr[offset + 2];
-        dst = (r << 16) | (g << 8) | b;
-    } else { // 16-bpp
-        uint16_t c = *((uint16_t*)(fb_byte_ptr + offset));
-        dst = rgb565_to_888(c);
-    }
-
-    uint8_t dr = (dst >> 16) & 0xFF;
-    uint8_t dg = (dst >> 8) & 0xFF;
-    uint8_t db = dst & 0xFF;
-
-    uint8_t sr = (color >> 16) & 0xFF;
-    uint8_t sg = (color >> 8) & 0xFF;
-    uint8_t sb = color & 0xFF;
-
-    uint8_t r = ((sr * alpha) + (dr * (255 - alpha))) / 255;
-    uint8_t g = ((sg * alpha) + (dg * (255 - alpha))) / 255;
-    uint8_t b = ((sb * alpha) + (db * (255 - alpha))) / 255;
-
-    uint32_t blended = (r << 16) | (g << 8) | b;
-    if (fb_bpp == 32) {
-        *((uint32_t*)(fb_byte_ptr + offset)) = blended;
-    } else if (fb_bpp == 24) {
-        fb_byte_ptr[offset + 0] = blended & 0xFF;
-        fb_byte_ptr[offset + 1] = (blended >> 8) & 0xFF;
-        fb_byte_ptr[offset + 2] = (blended >> 16) & 0xFF;
-    } else {
-        *((uint16_t*)(fb_byte_ptr + offset)) = rgb888_to_565(blended);
-    }
+    siv_damage(x, y, 1, 1);
+    blend_pixel(x, y, color, alpha);
 }
 
 void siv_get_screen_size(uint32_t* width, uint32_t* height) {
@@ -333,32 +1307,34 @@ void siv_get_screen_size(uint32_t* width, uint32_t* height) {
 }
 
 void siv_clear(uint32_t color) {
-    if (use_double_buffer && backbuffer) {
-        // Clear backbuffer directly with row strides
-        uint8_t* row_start = (uint8_t*)backbuffer;
-        size_t row_bytes = (size_t)fb_width * (fb_bpp / 8);
-        for (uint32_t y = 0; y < fb_height; ++y) {
-            if (fb_bpp == 32) {
-                uint32_t* row_ptr = (uint32_t*)row_start;
-                for (uint32_t x = 0; x < fb_width; ++x) row_ptr[x] = color;
-            } else {
-                for (uint32_t x = 0; x < fb_width; ++x) siv_put_pixel((int)x, (int)y, color);
-            }
-            row_start += row_bytes;
-        }
-        return;
-    }
-    if (fb_bpp == 32 && fb_pitch == fb_width * 4) {
+    int w = clip_x1 - clip_x0, h = clip_y1 - clip_y0;
+    if (w <= 0 || h <= 0) return;
+    siv_damage(clip_x0, clip_y0, w, h);
+    if (draw_bytespp == 4 && w == draw_w && draw_pitch == (uint32_t)draw_w * 4) {
         /* Fill using 32-bit writes so each pixel gets the intended colour.
            Using memset with a multi-byte value only repeats the lowest byte
            (0xXXXXXX**YY** → YYYY...). That produced the random artefacts you saw. */
-        uint32_t* ptr = (uint32_t*)fb;
-        size_t total = (size_t)fb_width * (size_t)fb_height;
-        for (size_t i = 0; i < total; ++i) {
-            ptr[i] = color;
-        }
-    } else {
-        siv_draw_rect(0, 0, fb_width, fb_height, color, true);
+        memset32(pixel_addr(0, clip_y0), color, (size_t)w * (size_t)h);
+        return;
+    }
+    uint8_t* row = pixel_addr(clip_x0, clip_y0);
+    for (int y = 0; y < h; ++y) {
+        span->fill(row, color, w);
+        row += draw_pitch;
+    }
+}
+
+void siv_blit(int x, int y, int w, int h, const uint32_t* pixels, int stride) {
+    int skip_x, skip_y;
+    if (!clip_box(&x, &y, &w, &h, &skip_x, &skip_y)) return;
+    pixels += (long)skip_y * stride + skip_x;
+
+    siv_damage(x, y, w, h);
+    uint8_t* row = pixel_addr(x, y);
+    for (int i = 0; i < h; i++) {
+        span->copy(row, pixels, w);
+        row += draw_pitch;
+        pixels += stride;
     }
 }
 
@@ -368,8 +1344,13 @@ void siv_draw_line(int x0, int y0, int x1, int y1, uint32_t color) {
     int dx = siv_abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
     int dy = -siv_abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
     int err = dx + dy, e2;
+    siv_damage(x0 < x1 ? x0 : x1, y0 < y1 ? y0 : y1, dx + 1, 1 - dy);
+    if (y0 == y1) {
+        fill_hspan(x0, x1, y0, color);
+        return;
+    }
     while (1) {
-        siv_put_pixel(x0, y0, color);
+        write_pixel(x0, y0, color);
         if (x0 == x1 && y0 == y1) break;
         e2 = 2 * err;
         if (e2 >= dy) { err += dy; x0 += sx; }
@@ -378,34 +1359,15 @@ void siv_draw_line(int x0, int y0, int x1, int y1, uint32_t color) {
 }
 
 void siv_draw_rect(int x, int y, int w, int h, uint32_t color, bool filled) {
-    // Clip rectangle to screen bounds
-    if (x < 0) { w += x; x = 0; }
-    if (y < 0) { h += y; y = 0; }
-    if (x + w > (int)fb_width) { w = fb_width - x; }
-    if (y + h > (int)fb_height) { h = fb_height - y; }
-    if (w <= 0 || h <= 0) return;
+    // Clip rectangle to the clip rect
+    if (!clip_box(&x, &y, &w, &h, 0, 0)) return;
 
     if (filled) {
-        uint8_t* base = (uint8_t*)(use_double_buffer && backbuffer ? (void*)backbuffer : (void*)fb);
-        uint32_t pitch_bytes = active_pitch_bytes();
-        uint8_t* row_start = base + y * pitch_bytes + x * (fb_bpp / 8);
-        if (fb_bpp == 32) {
-            // Optimized for 32bpp
-            uint32_t* row_ptr = (uint32_t*)row_start;
-            for (int i = 0; i < h; ++i) {
-                for (int j = 0; j < w; ++j) {
-                    row_ptr[j] = color;
-                }
-                row_ptr = (uint32_t*)((uint8_t*)row_ptr + pitch_bytes);
-            }
-        } else {
-             for (int i = 0; i < h; ++i) {
-                for (int j = 0; j < w; ++j) {
-                    siv_put_pixel(x + j, y + i, color);
-                }
-                // advance one row in the base pointer
-                row_start += pitch_bytes;
-            }
+        siv_damage(x, y, w, h);
+        uint8_t* row_start = pixel_addr(x, y);
+        for (int i = 0; i < h; ++i) {
+            span->fill(row_start, color, w);
+            row_start += draw_pitch;
         }
     } else {
         siv_draw_line(x, y, x + w - 1, y, color);
@@ -415,8 +1377,21 @@ void siv_draw_rect(int x, int y, int w, int h, uint32_t color, bool filled) {
     }
 }
 
+void siv_fill_rect_alpha(int x, int y, int w, int h, uint32_t color, uint8_t alpha) {
+    if (alpha == 0) return;
+    if (!clip_box(&x, &y, &w, &h, 0, 0)) return;
+
+    siv_damage(x, y, w, h);
+    uint8_t* row = pixel_addr(x, y);
+    for (int i = 0; i < h; i++) {
+        span->fill_alpha(row, color, alpha, w);
+        row += draw_pitch;
+    }
+}
+
 void siv_draw_circle(int xc, int yc, int r, uint32_t color, bool filled) {
     if (r <= 0) return;
+    siv_damage(xc - r, yc - r, 2 * r + 1, 2 * r + 1);
 
     if (filled) {
         int x0 = 0;
@@ -440,14 +1415,14 @@ void siv_draw_circle(int xc, int yc, int r, uint32_t color, bool filled) {
         int err = 0;
 
         while (x >= y) {
-            siv_put_pixel(xc + x, yc + y, color);
-            siv_put_pixel(xc + y, yc + x, color);
-            siv_put_pixel(xc - y, yc + x, color);
-            siv_put_pixel(xc - x, yc + y, color);
-            siv_put_pixel(xc - x, yc - y, color);
-            siv_put_pixel(xc - y, yc - x, color);
-            siv_put_pixel(xc + y, yc - x, color);
-            siv_put_pixel(xc + x, yc - y, color);
+            write_pixel(xc + x, yc + y, color);
+            write_pixel(xc + y, yc + x, color);
+            write_pixel(xc - y, yc + x, color);
+            write_pixel(xc - x, yc + y, color);
+            write_pixel(xc - x, yc - y, color);
+            write_pixel(xc - y, yc - x, color);
+            write_pixel(xc + y, yc - x, color);
+            write_pixel(xc + x, yc - y, color);
 
             if (err <= 0) {
                 y += 1;
@@ -466,83 +1441,180 @@ void siv_draw_char(int x, int y, char c, float scale, uint32_t color) {
     siv_draw_codepoint(x, y, (unsigned char)c, scale, color);
 }
 
-void siv_draw_text(int x, int y, const char* text, float scale, uint32_t color) {
-    if (!font_initialized) return;
-
-    float font_scale = stbtt_ScaleForPixelHeight(&font_info, 16.0f * scale);
-    int current_x = x;
+/* Text layout cache: siv_text_layout() shapes a string once into pen positions
+   and keeps the result keyed by (text, scale), so labels redrawn every frame
+   skip UTF-8 decoding and metric lookups. Entries are matched by hash and then
+   by the stored text, and the least recently used one is replaced. */
+#define SIV_LAYOUT_CACHE_SIZE 32
+
+typedef struct {
+    uint32_t hash;          // 0 when the entry is free
+    uint32_t last_used;
+    char text[SIV_LAYOUT_MAX_TEXT];
+    siv_text_layout_t layout;
+} siv_layout_entry_t;
+
+static siv_layout_entry_t layout_cache[SIV_LAYOUT_CACHE_SIZE];
+static uint32_t layout_clock = 0;
+// Misses are shaped here first, so text that does not fit evicts nothing.
+static siv_text_layout_t layout_scratch;
+
+static void layout_cache_reset(void) {
+    for (int i = 0; i < SIV_LAYOUT_CACHE_SIZE; i++) layout_cache[i].hash = 0;
+}
 
+// FNV-1a over the text and the scale's bits; never 0. Stores the text length.
+static uint32_t layout_hash(const char* text, float scale, size_t* len) {
+    union { float f; uint32_t u; } bits = { scale };
+    uint32_t h = 2166136261u ^ bits.u;
     const char* p = text;
+    for (; *p; p++) h = (h ^ (uint8_t)*p) * 16777619u;
+    *len = (size_t)(p - text);
+    return h ? h : 1;
+}
+
+// Block elements fill a cell as wide as 'M' and one line high.
+static void block_cell(float scale, int* cell_w, int* cell_h) {
+    int ascent;
+    text_vmetrics(scale, &ascent, cell_h);
+    *cell_w = text_advance(pack_scale(scale), scale, -1, 'M');
+    if (*cell_w <= 0) *cell_w = (int)(16.0f * scale);
+    if (*cell_h <= 0) *cell_h = (int)(16.0f * scale);
+}
+
+// Shape text into layout; false if it has more glyphs than a layout holds.
+static bool layout_build(siv_text_layout_t* layout, const char* text, float scale) {
+    const siv_pack_scale_t* ps = pack_scale(scale);
+    layout->scale = scale;
+    layout->glyph_count = 0;
+    text_vmetrics(scale, &layout->ascent, &layout->height);
+    block_cell(scale, &layout->cell_w, &layout->cell_h);
+
+    int pen = 0;
     int prev_cp = -1;
-    while (1) {
+    const char* p = text;
+    for (;;) {
         int cp = siv_utf8_decode_advance(&p);
         if (cp < 0) break;
+        if (layout->glyph_count == SIV_LAYOUT_MAX_GLYPHS) return false;
+        // Kerning against the previous glyph moves this glyph's pen position.
+        int advance = text_advance(ps, scale, prev_cp, cp);
+        if (prev_cp >= 0) {
+            int plain = text_advance(ps, scale, -1, cp);
+            pen += advance - plain;
+            advance = plain;
+        }
+        layout->glyphs[layout->glyph_count++] = (siv_layout_glyph_t){ cp, pen };
+        pen += advance;
+        prev_cp = cp;
+    }
+    layout->width = pen;
+    return true;
+}
+
+const siv_text_layout_t* siv_text_layout(const char* text, float scale) {
+    if (!text || (!font_initialized && !pack_scale(scale))) return NULL;
+
+    size_t len;
+    uint32_t hash = layout_hash(text, scale, &len);
+    if (len >= SIV_LAYOUT_MAX_TEXT) return NULL;
+
+    siv_layout_entry_t* victim = &layout_cache[0];
+    for (int i = 0; i < SIV_LAYOUT_CACHE_SIZE; i++) {
+        siv_layout_entry_t* e = &layout_cache[i];
+        if (e->hash == hash && e->layout.scale == scale && strcmp(e->text, text) == 0) {
+            e->last_used = ++layout_clock;
+            return &e->layout;
+        }
+        if (victim->hash != 0 && (e->hash == 0 || e->last_used < victim->last_used)) victim = e;
+    }
+
+    if (!layout_build(&layout_scratch, text, scale)) return NULL;
+    memcpy(&victim->layout, &layout_scratch, sizeof(layout_scratch));
+    memcpy(victim->text, text, len + 1);
+    victim->hash = hash;
+    victim->last_used = ++layout_clock;
+    return &victim->layout;
+}
+
+void siv_draw_layout(int x, int y, const siv_text_layout_t* layout, uint32_t color) {
+    if (!layout) return;
+    for (uint32_t i = 0; i < layout->glyph_count; i++) {
+        const siv_layout_glyph_t* g = &layout->glyphs[i];
         // Prefer font glyph; if it's a block element, synthesize bitmap for consistent look
-        if (siv_is_block_element(cp)) {
-            int ascent, descent, lineGap;
-            stbtt_GetFontVMetrics(&font_info, &ascent, &descent, &lineGap);
-            int cell_h = (int)((ascent - descent) * font_scale);
-            // Approximate cell width using 'M' advance as monospace-ish cell
-            int adv, lsb;
-            stbtt_GetCodepointHMetrics(&font_info, 'M', &adv, &lsb);
-            int cell_w = (int)(adv * font_scale);
-            if (cell_w <= 0) cell_w = (int)(16.0f * scale);
-            if (cell_h <= 0) cell_h = (int)(16.0f * scale);
-            siv_draw_block_element(current_x, y, scale, color, cp, cell_w, cell_h);
+        if (siv_is_block_element(g->codepoint)) {
+            siv_draw_block_element(x + g->x, y, layout->ascent, color, g->codepoint, layout->cell_w, layout->cell_h);
         } else {
-            // Render this codepoint via font
-            siv_draw_codepoint(current_x, y, cp, scale, color);
+            siv_draw_codepoint(x + g->x, y, g->codepoint, layout->scale, color);
         }
+    }
+}
 
-        // Advance by glyph metrics
-        int advanceWidth, leftSideBearing;
-        stbtt_GetCodepointHMetrics(&font_info, cp, &advanceWidth, &leftSideBearing);
-        current_x += (int)(advanceWidth * font_scale);
-
-        if (prev_cp >= 0) {
-            current_x += (int)(stbtt_GetCodepointKernAdvance(&font_info, prev_cp, cp) * font_scale);
+void siv_draw_text(int x, int y, const char* text, float scale, uint32_t color) {
+    const siv_text_layout_t* cached = siv_text_layout(text, scale);
+    if (cached) {
+        siv_draw_layout(x, y, cached, color);
+        return;
+    }
+    if (!text || (!font_initialized && !pack_scale(scale))) return;
+
+    // Too long for a layout: shape and draw in one pass.
+    int ascent, line_height, cell_w, cell_h;
+    text_vmetrics(scale, &ascent, &line_height);
+    block_cell(scale, &cell_w, &cell_h);
+    const siv_pack_scale_t* ps = pack_scale(scale);
+    int pen = x;
+    int prev_cp = -1;
+    const char* p = text;
+    for (;;) {
+        int cp = siv_utf8_decode_advance(&p);
+        if (cp < 0) break;
+        int advance = text_advance(ps, scale, -1, cp);
+        if (prev_cp >= 0) pen += text_advance(ps, scale, prev_cp, cp) - advance;
+        if (siv_is_block_element(cp)) {
+            siv_draw_block_element(pen, y, ascent, color, cp, cell_w, cell_h);
+        } else {
+            siv_draw_codepoint(pen, y, cp, scale, color);
         }
+        pen += advance;
         prev_cp = cp;
     }
 }
 
 void siv_get_text_size(const char* text, float scale, int* width, int* height) {
-    if (!font_initialized) {
+    const siv_text_layout_t* layout = siv_text_layout(text, scale);
+    if (layout) {
+        if (width) *width = layout->width;
+        if (height) *height = layout->height;
+        return;
+    }
+    const siv_pack_scale_t* ps = pack_scale(scale);
+    if (!text || (!font_initialized && !ps)) {
         if (width) *width = 0;
         if (height) *height = 0;
         return;
     }
 
-    float font_scale = stbtt_ScaleForPixelHeight(&font_info, 16.0f * scale);
     int w = 0;
-    int ascent, descent, lineGap;
-    stbtt_GetFontVMetrics(&font_info, &ascent, &descent, &lineGap);
-
     const char* p = text;
     int prev_cp = -1;
     while (1) {
         int cp = siv_utf8_decode_advance(&p);
         if (cp < 0) break;
-        int advanceWidth, leftSideBearing;
-        stbtt_GetCodepointHMetrics(&font_info, cp, &advanceWidth, &leftSideBearing);
-        w += (int)(advanceWidth * font_scale);
-        if (prev_cp >= 0) {
-            w += (int)(stbtt_GetCodepointKernAdvance(&font_info, prev_cp, cp) * font_scale);
-        }
+        w += text_advance(ps, scale, prev_cp, cp);
         prev_cp = cp;
     }
 
+    int ascent, line_height;
+    text_vmetrics(scale, &ascent, &line_height);
     if (width) *width = w;
-    if (height) *height = (int)((ascent - descent) * font_scale);
+    if (height) *height = line_height;
 }
 
 int siv_font_height(float scale) {
-    if (!font_initialized) return 0;
-
-    float font_scale = stbtt_ScaleForPixelHeight(&font_info, 16.0f * scale);
-    int ascent, descent, lineGap;
-    stbtt_GetFontVMetrics(&font_info, &ascent, &descent, &lineGap);
-    return (int)((ascent - descent) * font_scale);
+    int ascent, line_height;
+    text_vmetrics(scale, &ascent, &line_height);
+    return line_height;
 }
 
 unsigned char* siv_get_char_bitmap(char c, float scale, int* width, int* height, int* xoff, int* yoff) {
@@ -11,7 +11,48 @@ void siv_init(uint32_t width, uint32_t height, uint32_t pitch, uint32_t bpp, voi
 // and requires calling siv_present() each frame to copy to the real framebuffer.
 void siv_enable_double_buffer(bool enable);
 // Copy back buffer to the real framebuffer if double buffering is enabled.
+// Only the regions touched by draw calls since the last present are copied.
 void siv_present(void);
+// Mark a region as needing a copy on the next present, for callers that write
+// the back buffer behind SIV's back or want a full-frame copy.
+void siv_mark_dirty(int x, int y, int w, int h);
+
+typedef struct {
+    uint64_t frames;        // siv_present() calls with double buffering on
+    uint64_t last_bytes;    // bytes copied to the framebuffer by the last present
+    uint64_t total_bytes;
+    uint32_t last_rects;    // damage rectangles copied by the last present
+} siv_present_stats_t;
+
+void siv_get_present_stats(siv_present_stats_t* stats);
+
+// Software cursor plane, drawn straight into the framebuffer above the
+// presented scene with the pixels beneath it saved and restored on motion.
+// siv_present() keeps it on top. With double buffering off, draws that
+// overlap it lift it off until the next siv_present() or move.
+#define SIV_CURSOR_MAX 32
+// Sprite pixels are 0xAARRGGBB (alpha 0 is transparent), at most
+// SIV_CURSOR_MAX square, with the hotspot at (hot_x, hot_y)
+void siv_cursor_set_sprite(const uint32_t* argb, int w, int h, int hot_x, int hot_y);
+// Put the hotspot at (x, y)
+void siv_cursor_move(int x, int y);
+void siv_cursor_show(bool show);
+
+// Offscreen 32-bpp 0xRRGGBB image that can be drawn into and blitted later
+typedef struct {
+    uint32_t* pixels;
+    int w, h;
+} siv_surface_t;
+
+// Allocate a w x h surface from the PMM; contents start undefined
+bool siv_surface_create(siv_surface_t* surface, int w, int h);
+void siv_surface_destroy(siv_surface_t* surface);
+// Send all drawing to surface, or back to the screen when NULL. Drawing into
+// a surface records no damage. Resets the clip rect.
+void siv_set_target(siv_surface_t* surface);
+// Restrict drawing (and damage) on the current target to (x, y, w, h)
+void siv_set_clip(int x, int y, int w, int h);
+void siv_reset_clip(void);
 
 // Initialize the font from embedded TTF data
 bool siv_init_font(void);
@@ -28,15 +69,68 @@ void siv_draw_line(int x0, int y0, int x1, int y1, uint32_t color);
 // Draw a rectangle at (x, y) with width w and height h, color, and fill option
 void siv_draw_rect(int x, int y, int w, int h, uint32_t color, bool filled);
 
+// Blend color over a rectangle at the given alpha, e.g. a translucent shadow
+void siv_fill_rect_alpha(int x, int y, int w, int h, uint32_t color, uint8_t alpha);
+
 // Draw a circle at (xc, yc) with radius r, color, and fill option
 void siv_draw_circle(int xc, int yc, int r, uint32_t color, bool filled);
 
+// Blend color into n 32-bit pixels, weighting pixel i by coverage[i]
+// (0 keeps dst, 255 writes color). Anti-aliased text goes through this.
+void siv_blend_span(uint32_t* dst, uint32_t color, const uint8_t* coverage, int n);
+
+// Copy a w x h block of 0xRRGGBB pixels (stride in pixels) to (x, y), clipped
+// and converted to the framebuffer format
+void siv_blit(int x, int y, int w, int h, const uint32_t* pixels, int stride);
+
 // Draw text at (x, y) with a given size and color
 void siv_draw_text(int x, int y, const char* text, float size, uint32_t color);
 
+#define SIV_LAYOUT_MAX_GLYPHS 96
+#define SIV_LAYOUT_MAX_TEXT 128     // bytes, including the terminator
+
+typedef struct {
+    int32_t codepoint;
+    int32_t x;              // pen position relative to the layout origin
+} siv_layout_glyph_t;
+
+// A string shaped once at one scale: glyph positions and the text box
+typedef struct {
+    float scale;
+    int width, height;
+    int ascent;
+    int cell_w, cell_h;     // block element cell
+    uint32_t glyph_count;
+    siv_layout_glyph_t glyphs[SIV_LAYOUT_MAX_GLYPHS];
+} siv_text_layout_t;
+
+// Shape text at scale, or return the cached layout for the same (text, scale).
+// NULL if the text is too long to cache. The layout stays valid until evicted
+// by later calls, so draw or measure with it right away.
+const siv_text_layout_t* siv_text_layout(const char* text, float scale);
+
+// Draw a layout with its origin at (x, y), like siv_draw_text()
+void siv_draw_layout(int x, int y, const siv_text_layout_t* layout, uint32_t color);
+
 // Get the size of a string in pixels
 void siv_get_text_size(const char* text, float scale, int* width, int* height);
 
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;        // lookups that had to rasterise
+    uint64_t evictions;     // cached glyphs dropped to make room
+    uint64_t uncached;      // glyphs too large for an atlas cell
+    uint32_t entries;       // glyphs currently in the atlas
+    uint32_t sdf_glyphs;    // distance fields generated for SDF text
+} siv_glyph_cache_stats_t;
+
+// Counters of the (codepoint, scale) glyph cache used by text drawing
+void siv_get_glyph_cache_stats(siv_glyph_cache_stats_t* stats);
+
+// Draw text at scales without pre-rasterised glyphs from signed distance
+// fields (on by default), instead of rasterising every new scale
+void siv_enable_sdf_text(bool enable);
+
 // Get the height of the font in pixels
 int siv_font_height(float scale);
 
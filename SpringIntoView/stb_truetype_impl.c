@@ -1,25 +1,128 @@
-#include "../pmm.h" // For pmm_alloc
+#include <stdint.h>
+#include "../heap.h" // For kmalloc, kfree
 #include "../string.h" // For memcpy, memset, strlen
 
 // Provide memory allocation functions for stb_truetype
-#define STBTT_malloc(x,u) ((void)(u), pmm_alloc(x))
-#define STBTT_free(x,u)   ((void)(u)) // pmm_alloc can't free
-#define STBTT_realloc(p,n,u) ((void)(u), pmm_alloc(n)) // Simplistic realloc
+#define STBTT_malloc(x,u) ((void)(u), kmalloc(x))
+#define STBTT_free(x,u)   ((void)(u), kfree(x))
+#define STBTT_realloc(p,n,u) ((void)(u), krealloc(p,n))
 
 // Provide string functions for stb_truetype
 #define STBTT_memcpy(dest, src, size) memcpy(dest, src, size)
 #define STBTT_memset(ptr, value, size) memset(ptr, value, size)
 #define STBTT_strlen(str) strlen(str)
 
+/* Math for stb_truetype without libm. sqrt, pow, cos and acos are only hit
+   by composite glyph transforms and the SDF generator; the series below are
+   accurate to well past float precision over the ranges stb uses. */
+#define STBTT_K_PI 3.14159265358979323846
+#define STBTT_K_LN2 0.69314718055994530942
+
+#if defined(STBTT_HOST)
+// Host tools (tools/mkfontpack.c) link libm, whose sqrt rounds like sqrtsd.
+#include <math.h>
+
+static double stbtt_k_sqrt(double x) {
+    return x <= 0 ? 0 : sqrt(x);
+}
+#elif defined(__x86_64__)
+static double stbtt_k_sqrt(double x) {
+    if (x <= 0) return 0;
+    double r;
+    __asm__("sqrtsd %1, %0" : "=x"(r) : "x"(x));
+    return r;
+}
+#else
+// Halve the exponent for a first guess within ~6%, then Newton steps.
+static double stbtt_k_sqrt(double x) {
+    if (x <= 0) return 0;
+    union { double d; uint64_t u; } bits = { x };
+    bits.u = (bits.u >> 1) + (0x3FF0000000000000ULL >> 1);
+    double r = bits.d;
+    for (int i = 0; i < 6; i++) r = 0.5 * (r + x / r);
+    return r;
+}
+#endif
+
+// cos via Taylor series after folding x into [0, pi/2].
+static double stbtt_k_cos(double x) {
+    if (x < 0) x = -x;
+    x -= 2 * STBTT_K_PI * (double)(long)(x / (2 * STBTT_K_PI));
+    if (x > STBTT_K_PI) x = 2 * STBTT_K_PI - x;
+    double sign = 1;
+    if (x > STBTT_K_PI / 2) {
+        x = STBTT_K_PI - x;
+        sign = -1;
+    }
+    double x2 = x * x, term = 1, sum = 1;
+    for (int i = 1; i <= 9; i++) {
+        term *= -x2 / ((2 * i - 1) * (2 * i));
+        sum += term;
+    }
+    return sign * sum;
+}
+
+// atan for t >= 0: reduce to |t| <= tan(pi/8), then the odd power series.
+static double stbtt_k_atan(double t) {
+    if (t > 1) return STBTT_K_PI / 2 - stbtt_k_atan(1 / t);
+    double base = 0;
+    if (t > 0.41421356237309503) {
+        base = STBTT_K_PI / 4;
+        t = (t - 1) / (t + 1);
+    }
+    double t2 = t * t, term = t, sum = t;
+    for (int i = 1; i <= 12; i++) {
+        term *= -t2;
+        sum += term / (2 * i + 1);
+    }
+    return base + sum;
+}
+
+static double stbtt_k_acos(double x) {
+    if (x <= -1) return STBTT_K_PI;
+    if (x >= 1) return 0;
+    return 2 * stbtt_k_atan(stbtt_k_sqrt((1 - x) / (1 + x)));
+}
+
+// x^y for x > 0 as exp(y * ln x), splitting off the binary exponent each way.
+static double stbtt_k_pow(double x, double y) {
+    if (x <= 0) return 0;
+    union { double d; uint64_t u; } bits = { x };
+    int e = (int)((bits.u >> 52) & 0x7FF) - 1023;
+    bits.u = (bits.u & 0x000FFFFFFFFFFFFFULL) | 0x3FF0000000000000ULL;  // mantissa in [1, 2)
+    double m = bits.d;
+    if (m > 1.41421356237309505) {
+        m /= 2;
+        e++;
+    }
+    double z = (m - 1) / (m + 1), z2 = z * z, term = z, ln_m = z;
+    for (int i = 1; i <= 8; i++) {
+        term *= z2;
+        ln_m += term / (2 * i + 1);
+    }
+    double t = y * (2 * ln_m + e * STBTT_K_LN2);
+
+    double k = (double)(long)(t / STBTT_K_LN2 + (t < 0 ? -0.5 : 0.5));
+    double r = t - k * STBTT_K_LN2, rterm = 1, exp_r = 1;
+    for (int i = 1; i <= 13; i++) {
+        rterm *= r / i;
+        exp_r += rterm;
+    }
+    if (k > 1023) k = 1023;
+    if (k < -1022) return 0;
+    bits.u = (uint64_t)((long)k + 1023) << 52;
+    return exp_r * bits.d;
+}
+
 // Define necessary math functions to avoid including math.h for stb_truetype
 #define STBTT_ifloor(x) ((int)(x))
 #define STBTT_iceil(x) ((int)((x) + 0.999f))
-#define STBTT_sqrt(x) (0) // Not needed for our use case, returning 0
-#define STBTT_pow(x,y) (0) // Not needed for our use case, returning 0
+#define STBTT_sqrt(x) stbtt_k_sqrt(x)
+#define STBTT_pow(x,y) stbtt_k_pow(x, y)
 #define STBTT_fmod(x,y) ((x) - (y) * STBTT_ifloor((x)/(y)))
 #define STBTT_fabs(x) ((x) < 0 ? -(x) : (x))
-#define STBTT_acos(x) (0) // Not needed for our use case, returning 0
-#define STBTT_cos(x) (0) // Not needed for our use case, returning 0
+#define STBTT_acos(x) stbtt_k_acos(x)
+#define STBTT_cos(x) stbtt_k_cos(x)
 #define STBTT_assert(x) ((void)0)
 
 // Embed the stb_truetype implementation
@@ -4,6 +4,7 @@
 #include "serial.h"
 #include "speaker.h"
 #include "heap.h"
+#include "vmalloc.h"
 #include "pit.h"
 #include "io.h"
 #include "libs/minimp3.h"
@@ -104,7 +105,9 @@ struct audio_buffer* audio_create_buffer(size_t size, uint32_t sample_rate, uint
     struct audio_buffer* buffer = (struct audio_buffer*)kmalloc(sizeof(struct audio_buffer));
     if (!buffer) return NULL;
     
-    buffer->data = (uint8_t*)kmalloc(size);
+    // Decode buffers are sized for the worst case; vmalloc only commits
+    // the pages that actually get written.
+    buffer->data = (uint8_t*)vmalloc(size);
     if (!buffer->data) {
         kfree(buffer);
         return NULL;
@@ -127,7 +130,7 @@ void audio_free_buffer(struct audio_buffer* buffer) {
     if (!buffer) return;
     
     if (buffer->data) {
-        kfree(buffer->data);
+        vfree(buffer->data);
     }
     kfree(buffer);
 }
@@ -649,7 +652,7 @@ struct audio_buffer* audio_parse_wav(uint8_t* data, uint32_t size) {
     uint32_t data_size = header->data_size;
     
     // Validate data size
-    if (data_size == 0 || data_size > 64 * 1024) { // 64KB limit
+    if (data_size == 0 || data_size > 4 * 1024 * 1024) { // 4MB limit
         serial_writestring("Audio: Invalid or excessive data chunk size\n");
         audio_stability_failures++;
         return NULL;
@@ -673,7 +676,8 @@ struct audio_buffer* audio_parse_wav(uint8_t* data, uint32_t size) {
     }
     
     // Allocate data buffer with size validation
-    buffer->data = (uint8_t*)kmalloc(data_size);
+    // Up to 4 MB: vmalloc needs no physically contiguous run.
+    buffer->data = (uint8_t*)vmalloc(data_size);
     if (!buffer->data) {
         serial_writestring("Audio: Failed to allocate data buffer\n");
         kfree(buffer);
@@ -689,7 +693,7 @@ struct audio_buffer* audio_parse_wav(uint8_t* data, uint32_t size) {
         memcpy(buffer->data, data_ptr, data_size);
     } else {
         serial_writestring("Audio: Data bounds check failed\n");
-        kfree(buffer->data);
+        vfree(buffer->data);
         kfree(buffer);
         audio_stability_failures++;
         return NULL;
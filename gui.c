@@ -14,6 +14,8 @@ typedef struct {
 	bool dragging;
 	int drag_off_x;
 	int drag_off_y;
+	siv_surface_t surface;	// window contents, re-rendered only when dirty
+	bool dirty;
 } gui_window_t;
 
 static bool g_gui_active = false;
@@ -22,41 +24,132 @@ static uint32_t g_screen_h = 0;
 
 static gui_window_t g_demo;
 
-static void draw_taskbar(void)
+#define GUI_DESKTOP_COLOR 0x0033CC99
+#define GUI_TASKBAR_H 32
+#define GUI_SHADOW_OFFSET 4
+#define GUI_SHADOW_ALPHA 96
+#define GUI_CURSOR_W 13
+#define GUI_CURSOR_H 21
+
+// Taskbar including its separator line, rendered once
+static siv_surface_t g_taskbar;
+static bool g_taskbar_dirty = true;
+
+/* Screen regions to recomposite this frame. Each is rebuilt from the desktop
+   colour up, so overlapping entries only cost time. When the list is full the
+   new rect merges into the last entry. */
+#define GUI_MAX_DAMAGE 8
+typedef struct {
+	int x0, y0, x1, y1;
+} gui_rect_t;
+static gui_rect_t g_damage[GUI_MAX_DAMAGE];
+static int g_damage_count = 0;
+
+// Every GUI_STATS_FRAMES frames, log the average bytes presented per frame.
+#define GUI_STATS_FRAMES 600
+static uint64_t g_stats_frames = 0;
+static uint64_t g_stats_bytes = 0;
+
+static void report_present_stats(void)
+{
+	siv_present_stats_t stats;
+	siv_get_present_stats(&stats);
+	if (g_stats_frames == 0) {
+		g_stats_frames = stats.frames;
+		g_stats_bytes = stats.total_bytes;
+		return;
+	}
+	if (stats.frames - g_stats_frames < GUI_STATS_FRAMES) return;
+	serial_writestring("[GUI] presented ");
+	serial_writedec((stats.total_bytes - g_stats_bytes) / (stats.frames - g_stats_frames));
+	serial_writestring(" bytes/frame, last frame ");
+	serial_writedec(stats.last_rects);
+	serial_writestring(" rects\n");
+	siv_glyph_cache_stats_t glyphs;
+	siv_get_glyph_cache_stats(&glyphs);
+	serial_writestring("[GUI] glyph cache ");
+	serial_writedec(glyphs.hits);
+	serial_writestring(" hits, ");
+	serial_writedec(glyphs.misses);
+	serial_writestring(" misses, ");
+	serial_writedec(glyphs.evictions);
+	serial_writestring(" evictions\n");
+	g_stats_frames = stats.frames;
+	g_stats_bytes = stats.total_bytes;
+}
+
+static void gui_damage(int x, int y, int w, int h)
+{
+	gui_rect_t r = { x, y, x + w, y + h };
+	if (r.x0 < 0) r.x0 = 0;
+	if (r.y0 < 0) r.y0 = 0;
+	if (r.x1 > (int)g_screen_w) r.x1 = (int)g_screen_w;
+	if (r.y1 > (int)g_screen_h) r.y1 = (int)g_screen_h;
+	if (r.x0 >= r.x1 || r.y0 >= r.y1) return;
+	if (g_damage_count < GUI_MAX_DAMAGE) {
+		g_damage[g_damage_count++] = r;
+		return;
+	}
+	gui_rect_t* d = &g_damage[GUI_MAX_DAMAGE - 1];
+	if (r.x0 < d->x0) d->x0 = r.x0;
+	if (r.y0 < d->y0) d->y0 = r.y0;
+	if (r.x1 > d->x1) d->x1 = r.x1;
+	if (r.y1 > d->y1) d->y1 = r.y1;
+}
+
+static bool gui_rect_overlaps(const gui_rect_t* r, int x, int y, int w, int h)
+{
+	return x < r->x1 && r->x0 < x + w && y < r->y1 && r->y0 < y + h;
+}
+
+// Taskbar with its top-left (the separator line) at (ox, oy)
+static void draw_taskbar(int ox, int oy)
 {
-	const int tb_h = 32;
-	// Taskbar background
-	siv_draw_rect(0, (int)g_screen_h - tb_h, (int)g_screen_w, tb_h, 0x00222A33, true);
 	// Separator line
-	siv_draw_rect(0, (int)g_screen_h - tb_h - 1, (int)g_screen_w, 1, 0x00333C45, true);
+	siv_draw_rect(ox, oy, (int)g_screen_w, 1, 0x00333C45, true);
+	// Taskbar background
+	siv_draw_rect(ox, oy + 1, (int)g_screen_w, GUI_TASKBAR_H, 0x00222A33, true);
 	// Title
-	siv_draw_text(10, (int)g_screen_h - tb_h + 8, "SentinelOS", 1.0f, 0xFFFFFFFF);
+	siv_draw_text(ox + 10, oy + 1 + 8, "SentinelOS", 1.0f, 0xFFFFFFFF);
 }
 
-static void draw_window(gui_window_t* win)
+// Window contents with the window's top-left at (ox, oy)
+static void draw_window(gui_window_t* win, int ox, int oy)
 {
-	// Window shadow
-	siv_draw_rect(win->x + 4, win->y + 4, win->w, win->h, 0x00000000, true);
 	// Window body
-	siv_draw_rect(win->x, win->y, win->w, win->h, 0x00E3E8EE, true);
+	siv_draw_rect(ox, oy, win->w, win->h, 0x00E3E8EE, true);
 	// Title bar
-	siv_draw_rect(win->x, win->y, win->w, 24, win->dragging ? 0x004A90E2 : 0x003A7BD5, true);
+	siv_draw_rect(ox, oy, win->w, 24, win->dragging ? 0x004A90E2 : 0x003A7BD5, true);
 	// Title text
-	siv_draw_text(win->x + 8, win->y + 6, "Demo Window", 1.0f, 0xFFFFFFFF);
+	siv_draw_text(ox + 8, oy + 6, "Demo Window", 1.0f, 0xFFFFFFFF);
 	// Border
-	siv_draw_rect(win->x, win->y, win->w, 1, 0x00222A33, true);
-	siv_draw_rect(win->x, win->y + win->h - 1, win->w, 1, 0x00222A33, true);
-	siv_draw_rect(win->x, win->y, 1, win->h, 0x00222A33, true);
-	siv_draw_rect(win->x + win->w - 1, win->y, 1, win->h, 0x00222A33, true);
+	siv_draw_rect(ox, oy, win->w, 1, 0x00222A33, true);
+	siv_draw_rect(ox, oy + win->h - 1, win->w, 1, 0x00222A33, true);
+	siv_draw_rect(ox, oy, 1, win->h, 0x00222A33, true);
+	siv_draw_rect(ox + win->w - 1, oy, 1, win->h, 0x00222A33, true);
 
 	// Some content
-	siv_draw_text(win->x + 12, win->y + 36, "Hello from GUI!", 1.0f, 0x00000000);
+	siv_draw_text(ox + 12, oy + 36, "Hello from GUI!", 1.0f, 0x00000000);
+}
+
+static void draw_window_shadow(const gui_window_t* win)
+{
+	// Translucent shadow: only the strips right of and below the body show
+	siv_fill_rect_alpha(win->x + win->w, win->y + GUI_SHADOW_OFFSET, GUI_SHADOW_OFFSET, win->h, 0x00000000, GUI_SHADOW_ALPHA);
+	siv_fill_rect_alpha(win->x + GUI_SHADOW_OFFSET, win->y + win->h, win->w - GUI_SHADOW_OFFSET, GUI_SHADOW_OFFSET, 0x00000000, GUI_SHADOW_ALPHA);
 }
 
-static void draw_cursor(int x, int y)
+// Screen area a window covers, shadow included
+static void gui_damage_window(const gui_window_t* win)
+{
+	gui_damage(win->x, win->y, win->w + GUI_SHADOW_OFFSET, win->h + GUI_SHADOW_OFFSET);
+}
+
+// Render the arrow into an ARGB sprite for the SIV cursor plane
+static void build_cursor_sprite(uint32_t* sprite)
 {
     // 13x21 arrow with black border and white fill to reduce blending glitches
-    static const uint16_t mask[21] = {
+    static const uint16_t mask[GUI_CURSOR_H] = {
         0b1000000000000,
         0b1100000000000,
         0b1110000000000,
@@ -79,22 +172,74 @@ static void draw_cursor(int x, int y)
         0b1011110000000,
         0b0011100000000
     };
-    for (int row = 0; row < 21; ++row) {
+    for (int i = 0; i < GUI_CURSOR_W * GUI_CURSOR_H; ++i) sprite[i] = 0;
+    for (int row = 0; row < GUI_CURSOR_H; ++row) {
         uint16_t m = mask[row];
-        for (int col = 0; col < 13; ++col) {
+        uint32_t* px = sprite + row * GUI_CURSOR_W;
+        for (int col = 0; col < GUI_CURSOR_W; ++col) {
             if (m & (1 << (12 - col))) {
                 // border: draw black one-pixel outline around white core
-                siv_put_pixel(x + col, y + row, 0x00000000);
+                px[col] = 0xFF000000;
                 if (col > 0 && (m & (1 << (12 - (col - 1))))) {
-                    siv_put_pixel(x + col - 1, y + row, 0x00FFFFFF);
+                    px[col - 1] = 0xFFFFFFFF;
                 } else {
-                    siv_put_pixel(x + col, y + row, 0x00FFFFFF);
+                    px[col] = 0xFFFFFFFF;
                 }
             }
         }
     }
 }
 
+static int taskbar_top(void)
+{
+	return (int)g_screen_h - GUI_TASKBAR_H - 1;
+}
+
+// Re-render whatever surfaces changed since the last frame
+static void render_surfaces(void)
+{
+	if (g_taskbar_dirty && g_taskbar.pixels) {
+		siv_set_target(&g_taskbar);
+		draw_taskbar(0, 0);
+		siv_set_target(0);
+		gui_damage(0, taskbar_top(), (int)g_screen_w, GUI_TASKBAR_H + 1);
+	}
+	g_taskbar_dirty = false;
+	if (g_demo.dirty) {
+		if (g_demo.surface.pixels) {
+			siv_set_target(&g_demo.surface);
+			draw_window(&g_demo, 0, 0);
+			siv_set_target(0);
+		}
+		gui_damage(g_demo.x, g_demo.y, g_demo.w, g_demo.h);
+		g_demo.dirty = false;
+	}
+}
+
+/* Rebuild one screen rect bottom to top: desktop, taskbar, window shadow and
+   surface; the cursor is a separate SIV plane above all of it. Everything is
+   clipped to r, so a surface is one row copy per line of the overlap. Without
+   a surface (allocation failed) the element is drawn in place instead. */
+static void composite(const gui_rect_t* r)
+{
+	siv_set_clip(r->x0, r->y0, r->x1 - r->x0, r->y1 - r->y0);
+	siv_clear(GUI_DESKTOP_COLOR);
+
+	int tb_y = taskbar_top();
+	if (gui_rect_overlaps(r, 0, tb_y, (int)g_screen_w, GUI_TASKBAR_H + 1)) {
+		if (g_taskbar.pixels) siv_blit(0, tb_y, g_taskbar.w, g_taskbar.h, g_taskbar.pixels, g_taskbar.w);
+		else draw_taskbar(0, tb_y);
+	}
+
+	gui_window_t* win = &g_demo;
+	if (gui_rect_overlaps(r, win->x, win->y, win->w + GUI_SHADOW_OFFSET, win->h + GUI_SHADOW_OFFSET)) {
+		draw_window_shadow(win);
+		if (win->surface.pixels) siv_blit(win->x, win->y, win->w, win->h, win->surface.pixels, win->surface.w);
+		else draw_window(win, win->x, win->y);
+	}
+	siv_reset_clip();
+}
+
 bool gui_is_active(void)
 {
 	return g_gui_active;
@@ -110,8 +255,6 @@ void gui_init(void)
 	}
     // Turn on double buffering to avoid flicker on some emulators
     siv_enable_double_buffer(true);
-    // Desktop background (bright color for visibility)
-    siv_clear(0x0033CC99);
 	// Demo window
 	g_demo.x = (int)(g_screen_w / 2) - 200;
 	g_demo.y = (int)(g_screen_h / 2) - 120;
@@ -120,11 +263,30 @@ void gui_init(void)
 	g_demo.dragging = false;
 	g_demo.drag_off_x = 0;
 	g_demo.drag_off_y = 0;
+	g_demo.dirty = true;
+
+	// Offscreen surfaces; without one an element is redrawn on every composite
+	if (!siv_surface_create(&g_taskbar, (int)g_screen_w, GUI_TASKBAR_H + 1)) {
+		serial_writestring("[GUI] Out of memory for the taskbar surface, drawing it directly.\n");
+	}
+	if (!siv_surface_create(&g_demo.surface, g_demo.w, g_demo.h)) {
+		serial_writestring("[GUI] Out of memory for the window surface, drawing it directly.\n");
+	}
+	g_taskbar_dirty = true;
 
 	g_gui_active = true;
 
     // Center mouse
     mouse_set_position((int32_t)(g_screen_w / 2), (int32_t)(g_screen_h / 2));
+	uint32_t sprite[GUI_CURSOR_W * GUI_CURSOR_H];
+	build_cursor_sprite(sprite);
+	siv_cursor_set_sprite(sprite, GUI_CURSOR_W, GUI_CURSOR_H, 0, 0);
+	siv_cursor_move((int)(g_screen_w / 2), (int)(g_screen_h / 2));
+	siv_cursor_show(true);
+
+	// First frame composites the whole screen
+	g_damage_count = 0;
+	gui_damage(0, 0, (int)g_screen_w, (int)g_screen_h);
 }
 
 void gui_update(void)
@@ -140,7 +302,14 @@ void gui_update(void)
 	if (mx > (int)g_screen_w - 1) mx = (int)g_screen_w - 1;
 	if (my > (int)g_screen_h - 1) my = (int)g_screen_h - 1;
 
+	// The cursor plane saves and restores what is under it, so motion alone
+	// costs two small framebuffer writes and no recomposite
+	siv_cursor_move(mx, my);
+
 	// Drag logic on title bar
+	int old_x = g_demo.x;
+	int old_y = g_demo.y;
+	bool was_dragging = g_demo.dragging;
 	bool on_title = (mx >= g_demo.x && mx < g_demo.x + g_demo.w && my >= g_demo.y && my < g_demo.y + 24);
 	if (ms->left_button && on_title) {
 		if (!g_demo.dragging) {
@@ -155,20 +324,28 @@ void gui_update(void)
 		g_demo.x = mx - g_demo.drag_off_x;
 		g_demo.y = my - g_demo.drag_off_y;
 		// Clamp window within screen (leaving room for taskbar)
-		const int tb_h = 32;
+		const int tb_h = GUI_TASKBAR_H;
 		if (g_demo.x < 0) g_demo.x = 0;
 		if (g_demo.y < 0) g_demo.y = 0;
 		if (g_demo.x + g_demo.w > (int)g_screen_w) g_demo.x = (int)g_screen_w - g_demo.w;
 		if (g_demo.y + g_demo.h > (int)g_screen_h - tb_h) g_demo.y = (int)g_screen_h - tb_h - g_demo.h;
 	}
+	// Title bar colour follows the drag state
+	if (g_demo.dragging != was_dragging) g_demo.dirty = true;
+	if (g_demo.x != old_x || g_demo.y != old_y) {
+		gui_damage(old_x, old_y, g_demo.w + GUI_SHADOW_OFFSET, g_demo.h + GUI_SHADOW_OFFSET);
+		gui_damage_window(&g_demo);
+	}
 
-    // Draw
-    siv_clear(0x0033CC99);
-	draw_taskbar();
-	draw_window(&g_demo);
-    draw_cursor(mx, my);
+	// Draw: only changed surfaces are re-rendered, only damaged rects recomposited
+	render_surfaces();
+	for (int i = 0; i < g_damage_count; ++i) {
+		composite(&g_damage[i]);
+	}
+	g_damage_count = 0;
     // Present backbuffer if double buffering is enabled
     siv_present();
+	report_present_stats();
 }
 
 
@@ -4,20 +4,62 @@
  * A tiny kernel heap built on top of the page allocator (PMM).
  *
  * Design
- * - Classic K&R free-list allocator using a singly-linked circular list of
- *   blocks. Each allocated block is preceded by a header describing its size.
- * - When space is needed, we request another page from the PMM (morecore).
- * - Free coalesces with adjacent free blocks to limit fragmentation.
+ * - Small requests (up to HEAP_SLAB_MAX bytes) are served by a slab layer
+ *   with power-of-two size classes. Each slab is a naturally aligned PMM
+ *   block holding a header followed by equal-sized objects; free objects are
+ *   chained through their first word, so alloc and free are O(1) pops and
+ *   pushes. Slabs with free objects sit on a per-class partial list; a slab
+ *   that becomes empty is kept as the class's spare, or handed back to the
+ *   PMM if the class already has one.
+ * - Mid-sized requests use the classic K&R free-list allocator: a
+ *   singly-linked circular list of blocks, each allocated block preceded by a
+ *   header describing its size. When space is needed, we request enough
+ *   contiguous pages from the PMM (morecore). Free coalesces with adjacent
+ *   free blocks. Once more than HEAP_TRIM_HIGH bytes sit on the free list,
+ *   whole pages inside free blocks go back to the PMM until only
+ *   HEAP_TRIM_LOW bytes are left; the gap keeps grow/trim from thrashing.
+ * - Requests of HEAP_LARGE_MIN bytes or more get their own run of contiguous
+ *   PMM pages, starting at the returned pointer, so a page-sized request
+ *   takes exactly one page. krealloc() grows such a run in place when the
+ *   pages after it are free, and trims it when shrinking.
+ * - A byte per physical page (heap_page_map) records which pages hold slabs
+ *   and large runs, and how long each run is, so kfree() can route a pointer
+ *   without trusting anything stored near it.
+ * - PMM pages are used through the direct map (phys_to_virt), so the heap can
+ *   hand out any RAM, including memory above 4 GiB.
  *
  * Notes
  * - Simple, not thread-safe. Suitable for early kernel boot / single core.
- * - Alignment is pointer-aligned via header sizing; extend if you need stricter
- *   alignment requirements for DMA or SIMD.
+ * - kmalloc() returns 16-byte aligned memory: K&R blocks via header sizing,
+ *   slab objects are aligned to min(class size, 64), large runs are page
+ *   aligned. kmalloc_aligned() covers stricter alignments; krealloc()
+ *   only keeps that alignment while it resizes in place.
  */
 #include "heap.h"
 #include "pmm.h"
+#include "mem.h"
 #include "serial.h"
+#include "string.h"
+#if HEAP_PROFILE
+#include "pit.h"
+#endif
 #include <stddef.h>
+#include <stdint.h>
+
+#define HEAP_SLAB_MIN_SHIFT 4              // smallest class is 16 bytes
+#define HEAP_SLAB_HEADER 64                // objects start one cache line into the slab
+#define HEAP_SLAB_MAGIC 0x534C4142u        // "SLAB"
+#define HEAP_LARGE_MIN PAGE_SIZE           // from here on, allocate whole pages
+#define HEAP_TRIM_HIGH (256 * 1024)        // free-list bytes that trigger a trim
+#define HEAP_TRIM_LOW (64 * 1024)          // free-list bytes a trim leaves behind
+
+// heap_page_map entries: high nibble is the page type, low nibble the slab order.
+#define HEAP_PAGE_NONE 0x00
+#define HEAP_PAGE_SLAB 0x10
+#define HEAP_PAGE_LARGE 0x20               // first page of a large run
+#define HEAP_PAGE_LARGE_TAIL 0x30          // every later page of the run
+#define HEAP_PAGE_TYPE(e) ((e) & 0xF0)
+#define HEAP_PAGE_ORDER(e) ((e) & 0x0F)
 
 /* Allocation header stored immediately before each user block. */
 typedef struct header {
@@ -25,30 +67,287 @@ typedef struct header {
     size_t size;
 } header_t;
 
+/* Header at the start of every slab block. */
+typedef struct slab {
+    struct slab *next;      // partial list links
+    struct slab *prev;
+    void *free;             // first free object, chained through the objects
+    uint32_t magic;
+    uint16_t inuse;
+    uint16_t capacity;
+    uint8_t cls;
+    bool on_partial;
+} slab_t;
+
+typedef struct {
+    slab_t *partial;        // slabs with at least one free object
+    slab_t *empty;          // one spare empty slab, off the partial list
+    size_t slabs;
+    size_t objects_inuse;
+    size_t objects_total;
+} slab_class_t;
+
 static header_t base;
 static header_t *free_list = NULL;
 static size_t heap_total_size = 0;
+static size_t list_free_bytes = 0;
+static size_t released_pages = 0;
+
+static void list_free(header_t *bp);
+
+static slab_class_t slab_classes[HEAP_SLAB_CLASSES];
+static uint8_t *heap_page_map = NULL;
+static size_t heap_page_map_pages = 0;
+
+static size_t large_allocs = 0;
+static size_t large_pages = 0;
+
+/* Slab block order per class: small classes fit in one page, larger ones
+   use 2^order pages so a slab still holds several objects. */
+static unsigned int slab_order(unsigned int cls) {
+    size_t size = (size_t)1 << (cls + HEAP_SLAB_MIN_SHIFT);
+    unsigned int order = 0;
+    while (((PAGE_SIZE << order) - HEAP_SLAB_HEADER) / size < 4 && order < 2) order++;
+    return order;
+}
+
+static inline unsigned int slab_class_for(size_t nbytes) {
+    if (nbytes <= ((size_t)1 << HEAP_SLAB_MIN_SHIFT)) return 0;
+    return (unsigned int)(64 - __builtin_clzll(nbytes - 1)) - HEAP_SLAB_MIN_SHIFT;
+}
+
+/* PMM blocks are physical addresses; the heap works on their direct-map aliases. */
+static inline void* pages_virt(void *phys) {
+    return phys ? phys_to_virt((uint64_t)(uintptr_t)phys) : NULL;
+}
 
-/* Ask the PMM for at least one page and add it to the free list. */
+static inline void* pages_phys(const void *virt) {
+    return (void*)(uintptr_t)virt_to_phys(virt);
+}
+
+static void heap_page_map_set(void *block, unsigned int order, uint8_t entry) {
+    size_t page = virt_to_phys(block) / PAGE_SIZE;
+    for (size_t i = 0; i < ((size_t)1 << order); i++) {
+        if (page + i < heap_page_map_pages) heap_page_map[page + i] = entry;
+    }
+}
+
+/* Tag count pages starting at physical page `page`. */
+static void heap_page_map_fill(size_t page, size_t count, uint8_t entry) {
+    if (page >= heap_page_map_pages) return;
+    if (count > heap_page_map_pages - page) count = heap_page_map_pages - page;
+    memset(heap_page_map + page, entry, count);
+}
+
+static inline uint8_t heap_page_map_get(const void *ptr) {
+    size_t page = virt_to_phys(ptr) / PAGE_SIZE;
+    return page < heap_page_map_pages ? heap_page_map[page] : HEAP_PAGE_NONE;
+}
+
+static void slab_partial_push(slab_class_t *c, slab_t *s) {
+    s->prev = NULL;
+    s->next = c->partial;
+    if (c->partial) c->partial->prev = s;
+    c->partial = s;
+    s->on_partial = true;
+}
+
+static void slab_partial_remove(slab_class_t *c, slab_t *s) {
+    if (s->prev) s->prev->next = s->next;
+    else c->partial = s->next;
+    if (s->next) s->next->prev = s->prev;
+    s->next = s->prev = NULL;
+    s->on_partial = false;
+}
+
+/* Carve a fresh slab for class cls and put it on the partial list. */
+static slab_t* slab_grow(unsigned int cls) {
+    unsigned int order = slab_order(cls);
+    slab_t *s = (slab_t*)pages_virt(pmm_alloc_pages(order));
+    if (s == NULL) {
+        serial_writestring("[Serial] PMM out of memory for slab.\n");
+        return NULL;
+    }
+
+    size_t size = (size_t)1 << (cls + HEAP_SLAB_MIN_SHIFT);
+    s->magic = HEAP_SLAB_MAGIC;
+    s->cls = (uint8_t)cls;
+    s->inuse = 0;
+    s->capacity = (uint16_t)(((PAGE_SIZE << order) - HEAP_SLAB_HEADER) / size);
+    s->free = NULL;
+    uint8_t *obj = (uint8_t*)s + HEAP_SLAB_HEADER;
+    for (int i = s->capacity - 1; i >= 0; i--) {
+        void **o = (void**)(obj + (size_t)i * size);
+        *o = s->free;
+        s->free = o;
+    }
+
+    heap_page_map_set(s, order, (uint8_t)(HEAP_PAGE_SLAB | order));
+    slab_classes[cls].slabs++;
+    slab_classes[cls].objects_total += s->capacity;
+    slab_partial_push(&slab_classes[cls], s);
+    return s;
+}
+
+/* Give an empty slab's pages back to the PMM. */
+static void slab_release(slab_class_t *c, slab_t *s) {
+    unsigned int order = slab_order(s->cls);
+    heap_page_map_set(s, order, HEAP_PAGE_NONE);
+    s->magic = 0;
+    c->slabs--;
+    c->objects_total -= s->capacity;
+    released_pages += (size_t)1 << order;
+    pmm_free_pages(pages_phys(s), order);
+}
+
+static void* slab_alloc(unsigned int cls) {
+    slab_class_t *c = &slab_classes[cls];
+    slab_t *s = c->partial;
+    if (s == NULL && c->empty) {
+        s = c->empty;
+        c->empty = NULL;
+        slab_partial_push(c, s);
+    }
+    if (s == NULL && (s = slab_grow(cls)) == NULL) {
+        return NULL;
+    }
+
+    void **obj = (void**)s->free;
+    s->free = *obj;
+    s->inuse++;
+    c->objects_inuse++;
+    if (s->free == NULL) {
+        slab_partial_remove(c, s);
+    }
+    return obj;
+}
+
+static void slab_free(void *ptr, uint8_t entry) {
+    size_t slab_bytes = (size_t)PAGE_SIZE << HEAP_PAGE_ORDER(entry);
+    slab_t *s = (slab_t*)((uintptr_t)ptr & ~(uintptr_t)(slab_bytes - 1));
+    if (s->magic != HEAP_SLAB_MAGIC) {
+        serial_writestring("[Serial] kfree: bad slab pointer ");
+        serial_writehex((uint64_t)(uintptr_t)ptr);
+        serial_writestring("\n");
+        return;
+    }
+
+    slab_class_t *c = &slab_classes[s->cls];
+    *(void**)ptr = s->free;
+    s->free = ptr;
+    s->inuse--;
+    c->objects_inuse--;
+    if (s->inuse == 0) {
+        // Keep one empty slab per class so a lone alloc/free pair doesn't
+        // bounce pages through the PMM.
+        if (s->on_partial) slab_partial_remove(c, s);
+        if (c->empty == NULL) c->empty = s;
+        else slab_release(c, s);
+    } else if (!s->on_partial) {
+        slab_partial_push(c, s);
+    }
+}
+
+static inline size_t large_pages_for(size_t nbytes) {
+    return (nbytes + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
+static inline size_t page_of(const void *ptr) {
+    return virt_to_phys(ptr) / PAGE_SIZE;
+}
+
+/* Record [page, page+pages) as one large run. */
+static void large_tag(size_t page, size_t pages) {
+    heap_page_map_fill(page, 1, HEAP_PAGE_LARGE);
+    heap_page_map_fill(page + 1, pages - 1, HEAP_PAGE_LARGE_TAIL);
+}
+
+/* Length in pages of the large run starting at ptr, or 0 (with a complaint)
+   if ptr is not the start of one. */
+static size_t large_run_pages(void *ptr) {
+    size_t page = page_of(ptr);
+    if (((uintptr_t)ptr & (PAGE_SIZE - 1)) || heap_page_map_get(ptr) != HEAP_PAGE_LARGE) {
+        serial_writestring("[Serial] kfree: bad large pointer ");
+        serial_writehex((uint64_t)(uintptr_t)ptr);
+        serial_writestring("\n");
+        return 0;
+    }
+    size_t pages = 1;
+    while (page + pages < heap_page_map_pages && heap_page_map[page + pages] == HEAP_PAGE_LARGE_TAIL) {
+        pages++;
+    }
+    return pages;
+}
+
+/* Allocate a run of pages starting at an align-aligned address (a power of
+   two). For alignments above a page, the pages before and after the aligned
+   run go straight back to the PMM. */
+static void* large_alloc(size_t nbytes, size_t align) {
+    size_t pages = large_pages_for(nbytes);
+    size_t slack = align > PAGE_SIZE ? align / PAGE_SIZE - 1 : 0;
+    uint8_t *run = (uint8_t*)pages_virt(pmm_alloc((pages + slack) * PAGE_SIZE));
+    if (run == NULL) {
+        serial_writestring("[Serial] PMM out of memory for large allocation.\n");
+        return NULL;
+    }
+
+    uint8_t *user = (uint8_t*)(((uintptr_t)run + align - 1) & ~(uintptr_t)(align - 1));
+    size_t head = (size_t)(user - run) / PAGE_SIZE;
+    if (head) pmm_free(pages_phys(run), head * PAGE_SIZE);
+    if (slack > head) pmm_free(pages_phys(user + pages * PAGE_SIZE), (slack - head) * PAGE_SIZE);
+
+    large_tag(page_of(user), pages);
+    large_allocs++;
+    large_pages += pages;
+    return user;
+}
+
+static void large_free(void *ptr) {
+    size_t pages = large_run_pages(ptr);
+    if (pages == 0) return;
+
+    heap_page_map_fill(page_of(ptr), pages, HEAP_PAGE_NONE);
+    large_allocs--;
+    large_pages -= pages;
+    pmm_free(pages_phys(ptr), pages * PAGE_SIZE);
+}
+
+/* Resize the large run of old_pages pages at ptr without moving it.
+   Shrinking always succeeds; growing needs the pages right after the run
+   to be free. */
+static bool large_resize(void *ptr, size_t old_pages, size_t nbytes) {
+    size_t pages = large_pages_for(nbytes);
+    uint8_t *end = (uint8_t*)ptr + old_pages * PAGE_SIZE;
+
+    if (pages < old_pages) {
+        heap_page_map_fill(page_of(ptr) + pages, old_pages - pages, HEAP_PAGE_NONE);
+        pmm_free(pages_phys((uint8_t*)ptr + pages * PAGE_SIZE), (old_pages - pages) * PAGE_SIZE);
+    } else if (pages > old_pages) {
+        if (!pmm_claim(pages_phys(end), (pages - old_pages) * PAGE_SIZE)) return false;
+        heap_page_map_fill(page_of(end), pages - old_pages, HEAP_PAGE_LARGE_TAIL);
+    }
+    large_pages = large_pages - old_pages + pages;
+    return true;
+}
+
+/* Ask the PMM for enough contiguous pages for num_units and add them to the free list. */
 static header_t* morecore(size_t num_units) {
     char *cp;
     header_t *up;
 
-    if (num_units < (PAGE_SIZE / sizeof(header_t))) {
-        num_units = (PAGE_SIZE / sizeof(header_t));
-    }
-
-    cp = pmm_alloc_page();
+    size_t bytes = (num_units * sizeof(header_t) + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+    cp = pages_virt(pmm_alloc(bytes));
     if (cp == NULL) {
         serial_writestring("[Serial] PMM out of memory for heap.\n");
         return NULL;
     }
-    
+
     up = (header_t*) cp;
+    num_units = bytes / sizeof(header_t);
     up->size = num_units;
     heap_total_size += num_units * sizeof(header_t);
-    kfree((void*)(up + 1));
-    
+    list_free(up);
+
     return free_list;
 }
 
@@ -57,17 +356,75 @@ void heap_init() {
     base.next = &base;
     base.size = 0;
     free_list = &base;
+
+    // One byte per physical page lets kfree() tell slab objects apart.
+    pmm_info_t pinfo;
+    pmm_get_info(&pinfo);
+    heap_page_map = (uint8_t*)pages_virt(pmm_alloc(pinfo.total_pages));
+    if (heap_page_map) {
+        heap_page_map_pages = pinfo.total_pages;
+        memset(heap_page_map, HEAP_PAGE_NONE, heap_page_map_pages);
+    } else {
+        serial_writestring("[Serial] Heap: no page map, slab layer disabled.\n");
+    }
+
     morecore(1);
     serial_writestring("[Serial] Kernel heap initialized.\n");
 }
 
-/* Allocate at least nbytes and return a pointer to usable memory. */
-void* kmalloc(size_t nbytes) {
+/* Return whole pages inside free-list blocks to the PMM until the free list
+   is down to HEAP_TRIM_LOW bytes. Pages are cut from the end of each block;
+   any partial-page head or tail stays on the list as a smaller block. */
+static void heap_trim(void) {
+    header_t *prevp = &base;
+    header_t *p = base.next;
+
+    while (p != &base && list_free_bytes > HEAP_TRIM_LOW) {
+        uintptr_t start = (uintptr_t)p;
+        uintptr_t end = start + p->size * sizeof(header_t);
+        uintptr_t first = (start + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE - 1);
+        uintptr_t last = end & ~(uintptr_t)(PAGE_SIZE - 1);
+        if (last <= first) {
+            prevp = p;
+            p = p->next;
+            continue;
+        }
+
+        size_t pages = (last - first) / PAGE_SIZE;
+        size_t excess = (list_free_bytes - HEAP_TRIM_LOW) / PAGE_SIZE;
+        if (pages > excess) pages = excess;
+        if (pages == 0) break;
+        first = last - pages * PAGE_SIZE;
+
+        header_t *next = p->next;
+        if (end > last) {
+            header_t *tail = (header_t*)last;
+            tail->size = (end - last) / sizeof(header_t);
+            tail->next = next;
+            next = tail;
+        }
+        if (first > start) {
+            p->size = (first - start) / sizeof(header_t);
+            p->next = next;
+            prevp = p;
+        } else {
+            prevp->next = next;
+        }
+        p = next;
+
+        pmm_free(pages_phys((void*)first), pages * PAGE_SIZE);
+        heap_total_size -= pages * PAGE_SIZE;
+        list_free_bytes -= pages * PAGE_SIZE;
+        released_pages += pages;
+    }
+    free_list = &base;
+}
+
+/* K&R first-fit allocation from the circular free list. */
+static void* list_alloc(size_t nbytes) {
     header_t *p, *prevp;
     size_t nunits;
 
-    if (nbytes == 0) return NULL;
-
     nunits = (nbytes + sizeof(header_t) - 1) / sizeof(header_t) + 1;
 
     prevp = free_list;
@@ -80,6 +437,7 @@ void* kmalloc(size_t nbytes) {
                 p += p->size;
                 p->size = nunits;
             }
+            list_free_bytes -= nunits * sizeof(header_t);
             free_list = prevp;
             return (void*)(p + 1);
         }
@@ -91,15 +449,288 @@ void* kmalloc(size_t nbytes) {
     }
 }
 
-/* Free a block previously returned by kmalloc(). */
-void kfree(void* ptr) {
+#if HEAP_PROFILE
+/*
+ * Allocation profiler (build with -DHEAP_PROFILE=1).
+ * Every live allocation is kept in an open-addressed table keyed by pointer,
+ * holding the caller's return address, size and PIT tick; kfree() deletes it
+ * with backward-shift deletion so no tombstones build up. Per-call-site
+ * totals live in a second small table keyed by caller. Both are static so
+ * the profiler never allocates. Anything that does not fit is counted as
+ * untracked instead.
+ */
+#define HEAP_PROFILE_SLOTS 4096            // live allocations, power of two
+#define HEAP_PROFILE_SITES 256             // distinct call sites, power of two
+#define HEAP_PROFILE_TOP 10
+#define HEAP_PROFILE_OLDEST 16
+
+typedef struct {
+    void *ptr;
+    void *caller;
+    size_t size;
+    uint64_t tick;
+} prof_alloc_t;
+
+typedef struct {
+    void *caller;
+    size_t count;                          // allocations since boot
+    size_t bytes;
+    size_t live_count;                     // still outstanding
+    size_t live_bytes;
+} prof_site_t;
+
+static prof_alloc_t prof_allocs[HEAP_PROFILE_SLOTS];
+static prof_site_t prof_sites[HEAP_PROFILE_SITES];
+static size_t prof_live = 0;
+static size_t prof_untracked = 0;
+
+static inline size_t prof_hash(const void *key, size_t slots) {
+    return (size_t)((((uintptr_t)key >> 4) * 0x9E3779B97F4A7C15ULL) >> 32) & (slots - 1);
+}
+
+static prof_site_t* prof_site(void *caller) {
+    size_t i = prof_hash(caller, HEAP_PROFILE_SITES);
+    for (size_t n = 0; n < HEAP_PROFILE_SITES; n++, i = (i + 1) & (HEAP_PROFILE_SITES - 1)) {
+        if (prof_sites[i].caller == caller) return &prof_sites[i];
+        if (prof_sites[i].caller == NULL) {
+            prof_sites[i].caller = caller;
+            return &prof_sites[i];
+        }
+    }
+    return NULL;
+}
+
+static void prof_record(void *ptr, size_t size, void *caller) {
+    if (ptr == NULL) return;
+    if (prof_live >= HEAP_PROFILE_SLOTS - HEAP_PROFILE_SLOTS / 8) {
+        prof_untracked++;                  // keep probe chains short
+        return;
+    }
+    prof_site_t *site = prof_site(caller);
+    if (site == NULL) {
+        prof_untracked++;
+        return;
+    }
+
+    size_t i = prof_hash(ptr, HEAP_PROFILE_SLOTS);
+    while (prof_allocs[i].ptr != NULL) i = (i + 1) & (HEAP_PROFILE_SLOTS - 1);
+    prof_allocs[i].ptr = ptr;
+    prof_allocs[i].caller = caller;
+    prof_allocs[i].size = size;
+    prof_allocs[i].tick = pit_get_ticks();
+    prof_live++;
+
+    site->count++;
+    site->bytes += size;
+    site->live_count++;
+    site->live_bytes += size;
+}
+
+static void prof_forget(void *ptr) {
+    if (ptr == NULL) return;
+    size_t i = prof_hash(ptr, HEAP_PROFILE_SLOTS);
+    while (prof_allocs[i].ptr != ptr) {
+        if (prof_allocs[i].ptr == NULL) return;  // allocated while untracked
+        i = (i + 1) & (HEAP_PROFILE_SLOTS - 1);
+    }
+
+    prof_site_t *site = prof_site(prof_allocs[i].caller);
+    if (site) {
+        site->live_count--;
+        site->live_bytes -= prof_allocs[i].size;
+    }
+    prof_live--;
+
+    // Backward-shift: pull later entries of the probe chain into the hole.
+    prof_allocs[i].ptr = NULL;
+    for (size_t j = (i + 1) & (HEAP_PROFILE_SLOTS - 1); prof_allocs[j].ptr != NULL;
+         j = (j + 1) & (HEAP_PROFILE_SLOTS - 1)) {
+        size_t home = prof_hash(prof_allocs[j].ptr, HEAP_PROFILE_SLOTS);
+        if (((j - home) & (HEAP_PROFILE_SLOTS - 1)) >= ((j - i) & (HEAP_PROFILE_SLOTS - 1))) {
+            prof_allocs[i] = prof_allocs[j];
+            prof_allocs[j].ptr = NULL;
+            i = j;
+        }
+    }
+}
+
+static void prof_print_site(const prof_site_t *site) {
+    serial_writestring("  ");
+    serial_writehex((uint64_t)(uintptr_t)site->caller);
+    serial_writestring("  count=");
+    serial_writedec(site->count);
+    serial_writestring(" bytes=");
+    serial_writedec(site->bytes);
+    serial_writestring(" live=");
+    serial_writedec(site->live_count);
+    serial_writestring("/");
+    serial_writedec(site->live_bytes);
+    serial_writestring("\n");
+}
+
+/* Print the HEAP_PROFILE_TOP sites ranked by bytes or by count. */
+static void prof_print_top(bool by_bytes) {
+    const prof_site_t *shown[HEAP_PROFILE_TOP];
+    size_t nshown = 0;
+    while (nshown < HEAP_PROFILE_TOP) {
+        const prof_site_t *best = NULL;
+        for (size_t i = 0; i < HEAP_PROFILE_SITES; i++) {
+            const prof_site_t *s = &prof_sites[i];
+            if (s->caller == NULL) continue;
+            bool taken = false;
+            for (size_t k = 0; k < nshown; k++) taken |= (shown[k] == s);
+            if (taken) continue;
+            size_t key = by_bytes ? s->bytes : s->count;
+            if (best == NULL || key > (by_bytes ? best->bytes : best->count)) best = s;
+        }
+        if (best == NULL) break;
+        shown[nshown++] = best;
+        prof_print_site(best);
+    }
+}
+
+void heap_profile_dump(void) {
+    serial_writestring("[heapprof] live allocations: ");
+    serial_writedec(prof_live);
+    serial_writestring(", untracked: ");
+    serial_writedec(prof_untracked);
+    serial_writestring("\n[heapprof] top sites by bytes (caller, count, bytes, live count/bytes):\n");
+    prof_print_top(true);
+    serial_writestring("[heapprof] top sites by count:\n");
+    prof_print_top(false);
+
+    // Oldest outstanding allocations first; long-lived ones are leak suspects.
+    serial_writestring("[heapprof] oldest outstanding allocations (ptr, size, caller, tick):\n");
+    uint64_t after = 0;
+    const prof_alloc_t *last = NULL;
+    for (int n = 0; n < HEAP_PROFILE_OLDEST; n++) {
+        const prof_alloc_t *oldest = NULL;
+        for (size_t i = 0; i < HEAP_PROFILE_SLOTS; i++) {
+            const prof_alloc_t *a = &prof_allocs[i];
+            if (a->ptr == NULL) continue;
+            if (last && (a->tick < after || (a->tick == after && a <= last))) continue;
+            if (oldest == NULL || a->tick < oldest->tick || (a->tick == oldest->tick && a < oldest)) oldest = a;
+        }
+        if (oldest == NULL) break;
+        serial_writestring("  ");
+        serial_writehex((uint64_t)(uintptr_t)oldest->ptr);
+        serial_writestring(" ");
+        serial_writedec(oldest->size);
+        serial_writestring(" ");
+        serial_writehex((uint64_t)(uintptr_t)oldest->caller);
+        serial_writestring(" ");
+        serial_writedec(oldest->tick);
+        serial_writestring("\n");
+        after = oldest->tick;
+        last = oldest;
+    }
+}
+#else
+static inline void prof_record(void *ptr, size_t size, void *caller) { (void)ptr; (void)size; (void)caller; }
+static inline void prof_forget(void *ptr) { (void)ptr; }
+
+void heap_profile_dump(void) {
+    serial_writestring("[heapprof] Profiler not built in; rebuild with -DHEAP_PROFILE=1\n");
+}
+#endif
+
+static void* heap_alloc(size_t nbytes) {
+    if (nbytes == 0) return NULL;
+
+    if (nbytes <= HEAP_SLAB_MAX && heap_page_map) {
+        return slab_alloc(slab_class_for(nbytes));
+    }
+    if (nbytes >= HEAP_LARGE_MIN && heap_page_map) {
+        return large_alloc(nbytes, PAGE_SIZE);
+    }
+    return list_alloc(nbytes);
+}
+
+/* Allocate at least nbytes and return a pointer to usable memory. */
+void* kmalloc(size_t nbytes) {
+    void *ptr = heap_alloc(nbytes);
+    prof_record(ptr, nbytes, __builtin_return_address(0));
+    return ptr;
+}
+
+static void* heap_alloc_aligned(size_t nbytes, size_t align) {
+    if (nbytes == 0 || align == 0 || (align & (align - 1))) return NULL;
+    if (align <= sizeof(header_t)) return heap_alloc(nbytes);
+    if (!heap_page_map) return NULL;
+
+    if (align <= HEAP_SLAB_HEADER && nbytes <= HEAP_SLAB_MAX) {
+        // Slab objects are aligned to min(class size, HEAP_SLAB_HEADER).
+        return slab_alloc(slab_class_for(nbytes < align ? align : nbytes));
+    }
+    return large_alloc(nbytes, align);
+}
+
+/* Allocate nbytes aligned to align, which must be a power of two. Alignments
+   up to 64 bytes come from the slab class that covers them; larger ones go
+   to a page run starting on an aligned page. */
+void* kmalloc_aligned(size_t nbytes, size_t align) {
+    void *ptr = heap_alloc_aligned(nbytes, align);
+    prof_record(ptr, nbytes, __builtin_return_address(0));
+    return ptr;
+}
+
+/* Allocate a zeroed array of count elements of size bytes each. */
+void* kcalloc(size_t count, size_t size) {
+    if (size && count > (size_t)-1 / size) return NULL;
+    void *ptr = heap_alloc(count * size);
+    if (ptr) memset(ptr, 0, count * size);
+    prof_record(ptr, count * size, __builtin_return_address(0));
+    return ptr;
+}
+
+/* Allocate count zeroed, page-aligned pages. Single pages come from the
+   PMM's pre-zeroed pool, so the common case does no clearing here. */
+void* kzalloc_pages(size_t count) {
+    if (count == 0) return NULL;
+    if (count == 1) return pages_virt(pmm_alloc_zeroed_page());
+
+    void *pages = pages_virt(pmm_alloc(count * PAGE_SIZE));
+    if (pages) memset(pages, 0, count * PAGE_SIZE);
+    return pages;
+}
+
+void kfree_pages(void* ptr, size_t count) {
+    pmm_free(pages_phys(ptr), count * PAGE_SIZE);
+}
+
+static void heap_free(void* ptr) {
     if (ptr == NULL) {
         return;
     }
 
-    header_t *bp = (header_t*)ptr - 1;
+    uint8_t entry = heap_page_map_get(ptr);
+    if (HEAP_PAGE_TYPE(entry) == HEAP_PAGE_SLAB) {
+        slab_free(ptr, entry);
+        return;
+    }
+    if (HEAP_PAGE_TYPE(entry) == HEAP_PAGE_LARGE || HEAP_PAGE_TYPE(entry) == HEAP_PAGE_LARGE_TAIL) {
+        large_free(ptr);
+        return;
+    }
+
+    list_free((header_t*)ptr - 1);
+    if (list_free_bytes > HEAP_TRIM_HIGH) {
+        heap_trim();
+    }
+}
+
+/* Free a block previously returned by kmalloc(). */
+void kfree(void* ptr) {
+    prof_forget(ptr);
+    heap_free(ptr);
+}
+
+/* Insert a block into the address-ordered free list, coalescing neighbours. */
+static void list_free(header_t *bp) {
     header_t *p;
 
+    list_free_bytes += bp->size * sizeof(header_t);
+
     for (p = free_list; !(bp > p && bp < p->next); p = p->next) {
         if (p >= p->next && (bp > p || bp < p->next)) {
             break;
@@ -119,21 +750,94 @@ void kfree(void* ptr) {
     } else {
         p->next = bp;
     }
-    
+
     free_list = p;
 }
 
+/* Usable bytes behind a kmalloc() pointer, or 0 if it is not recognised. */
+static size_t heap_usable_size(void *ptr, uint8_t entry) {
+    if (HEAP_PAGE_TYPE(entry) == HEAP_PAGE_SLAB) {
+        size_t slab_bytes = (size_t)PAGE_SIZE << HEAP_PAGE_ORDER(entry);
+        slab_t *s = (slab_t*)((uintptr_t)ptr & ~(uintptr_t)(slab_bytes - 1));
+        return s->magic == HEAP_SLAB_MAGIC ? (size_t)1 << (s->cls + HEAP_SLAB_MIN_SHIFT) : 0;
+    }
+    if (HEAP_PAGE_TYPE(entry) == HEAP_PAGE_LARGE || HEAP_PAGE_TYPE(entry) == HEAP_PAGE_LARGE_TAIL) {
+        return large_run_pages(ptr) * PAGE_SIZE;
+    }
+    return (((header_t*)ptr - 1)->size - 1) * sizeof(header_t);
+}
+
+/* Resize a block, keeping its contents up to the smaller of the two sizes.
+   Large runs grow or shrink in place when they can; everything else moves
+   only when the new size no longer fits the current block. */
+void* krealloc(void* ptr, size_t nbytes) {
+    void *caller = __builtin_return_address(0);
+    if (ptr == NULL) {
+        ptr = heap_alloc(nbytes);
+        prof_record(ptr, nbytes, caller);
+        return ptr;
+    }
+    if (nbytes == 0) {
+        kfree(ptr);
+        return NULL;
+    }
+
+    uint8_t entry = heap_page_map_get(ptr);
+    size_t old_size = heap_usable_size(ptr, entry);
+    if (old_size == 0) return NULL;
+
+    void *new_ptr = ptr;
+    if (HEAP_PAGE_TYPE(entry) == HEAP_PAGE_LARGE && nbytes >= HEAP_LARGE_MIN &&
+        large_resize(ptr, old_size / PAGE_SIZE, nbytes)) {
+        // Resized in place.
+    } else if (HEAP_PAGE_TYPE(entry) != HEAP_PAGE_LARGE && nbytes <= old_size) {
+        // Still fits the current block.
+    } else {
+        new_ptr = heap_alloc(nbytes);
+        if (new_ptr == NULL) return NULL;
+        memcpy(new_ptr, ptr, nbytes < old_size ? nbytes : old_size);
+        heap_free(ptr);
+    }
+
+    prof_forget(ptr);
+    prof_record(new_ptr, nbytes, caller);
+    return new_ptr;
+}
+
 /* Report heap accounting stats (approximate). */
 void heap_get_info(heap_info_t* info) {
     if (!info) return;
 
     header_t* p;
     size_t free_bytes = 0;
-    for (p = free_list->next; p != &base; p = p->next) {
-        free_bytes += p->size * sizeof(header_t);
+    info->free_blocks = 0;
+    info->largest_free_block = 0;
+    for (p = base.next; p != &base; p = p->next) {
+        size_t bytes = p->size * sizeof(header_t);
+        free_bytes += bytes;
+        info->free_blocks++;
+        if (bytes > info->largest_free_block) info->largest_free_block = bytes;
+    }
+    // External fragmentation: share of free-list memory outside the largest block.
+    info->fragmentation_pct = free_bytes ? 100 - (info->largest_free_block * 100) / free_bytes : 0;
+    info->released_pages = released_pages;
+
+    size_t slab_total = 0;
+    size_t slab_used = 0;
+    for (unsigned int cls = 0; cls < HEAP_SLAB_CLASSES; cls++) {
+        slab_class_t *c = &slab_classes[cls];
+        info->classes[cls].object_size = (size_t)1 << (cls + HEAP_SLAB_MIN_SHIFT);
+        info->classes[cls].slabs = c->slabs;
+        info->classes[cls].objects_inuse = c->objects_inuse;
+        info->classes[cls].objects_total = c->objects_total;
+        slab_total += c->slabs * ((size_t)PAGE_SIZE << slab_order(cls));
+        slab_used += c->objects_inuse * info->classes[cls].object_size;
     }
 
-    info->total_bytes = heap_total_size;
-    info->free_bytes = free_bytes;
-    info->used_bytes = heap_total_size - free_bytes;
-} 
\ No newline at end of file
+    info->large_allocs = large_allocs;
+    info->large_bytes = large_pages * PAGE_SIZE;
+
+    info->total_bytes = heap_total_size + slab_total + info->large_bytes;
+    info->free_bytes = free_bytes + (slab_total - slab_used);
+    info->used_bytes = info->total_bytes - info->free_bytes;
+}
@@ -3,15 +3,54 @@
 
 #include <stddef.h>
 
+// Build with -DHEAP_PROFILE=1 to record the call site of every allocation
+// (dumped over serial by the heapprof shell command).
+#ifndef HEAP_PROFILE
+#define HEAP_PROFILE 0
+#endif
+
+// Slab size classes: powers of two from 16 to HEAP_SLAB_MAX bytes.
+#define HEAP_SLAB_CLASSES 8
+#define HEAP_SLAB_MAX 2048
+
+typedef struct {
+    size_t object_size;
+    size_t slabs;           // slab blocks carved from the PMM
+    size_t objects_inuse;
+    size_t objects_total;
+} heap_class_info_t;
+
 typedef struct {
     size_t total_bytes;
     size_t used_bytes;
     size_t free_bytes;
+    heap_class_info_t classes[HEAP_SLAB_CLASSES];
+    // Page-granular allocations of a page or more.
+    size_t large_allocs;
+    size_t large_bytes;
+    // Free-list shape: block count, largest block and the percentage of free
+    // bytes outside the largest block (external fragmentation).
+    size_t free_blocks;
+    size_t largest_free_block;
+    size_t fragmentation_pct;
+    // Pages handed back to the PMM since boot (trimmed spans and empty slabs).
+    size_t released_pages;
 } heap_info_t;
 
 void heap_init();
 void* kmalloc(size_t size);
 void kfree(void* ptr);
+// Resize a kmalloc() block; large blocks grow in place when the next pages are free.
+void* krealloc(void* ptr, size_t size);
+// Aligned (align is a power of two) and zeroed kmalloc(); release both with kfree().
+void* kmalloc_aligned(size_t size, size_t align);
+void* kcalloc(size_t count, size_t size);
+// Zeroed, page-aligned whole pages straight from the PMM. Release them with
+// kfree_pages() and the same count, never with kfree().
+void* kzalloc_pages(size_t count);
+void kfree_pages(void* ptr, size_t count);
 void heap_get_info(heap_info_t* info);
+// Print top allocation sites and the oldest live allocations to serial.
+void heap_profile_dump(void);
 
-#endif // HEAP_H 
\ No newline at end of file
+#endif // HEAP_H 
@@ -25,6 +25,12 @@ isr%1:
 %endmacro
 
 isr_common_stub:
+    ; r8-r11 are caller-saved in the C ABI; handlers that return into
+    ; arbitrary code (IRQs, demand-paging faults) must not clobber them.
+    push r11
+    push r10
+    push r9
+    push r8
     push rax
     push rcx
     push rdx
@@ -33,9 +39,17 @@ isr_common_stub:
     push rsi
     push rdi
 
-    mov rdi, rsp ; Pass registers* to C handler
+    ; Handlers may use SSE (memcpy/memset); keep the interrupted code's
+    ; x87/SSE state. RSP is 16-byte aligned here, as fxsave requires.
+    sub rsp, 512
+    fxsave [rsp]
+
+    lea rdi, [rsp + 512] ; Pass registers* to C handler
     call isr_handler_c
 
+    fxrstor [rsp]
+    add rsp, 512
+
     pop rdi
     pop rsi
     pop rbp
@@ -43,6 +57,10 @@ isr_common_stub:
     pop rdx
     pop rcx
     pop rax
+    pop r8
+    pop r9
+    pop r10
+    pop r11
 
     add rsp, 16 ; Pop int_no and err_code
     iretq
@@ -6,6 +6,7 @@
 #include "mouse.h"
 #include "serial.h"
 #include "io.h"
+#include "vmalloc.h"
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -82,6 +83,11 @@ void page_fault_handler(registers* regs) {
     uint64_t fault_addr;
     asm volatile("mov %%cr2, %0" : "=r"(fault_addr));
 
+    // First touch of a vmalloc() page: back it and retry the access.
+    if (vmalloc_handle_fault(fault_addr, regs->err_code)) {
+        return;
+    }
+
     serial_writestring("Page fault at address ");
     serial_writehex(fault_addr);
     serial_writestring("\n");
@@ -144,6 +150,8 @@ void isr_install() {
     idt_set_gate(46, (uint64_t)isr46, 0x08, 0x8E);
     idt_set_gate(47, (uint64_t)isr47, 0x08, 0x8E);
 
+    // Page faults may be demand-paging requests that return to the faulting code
+    register_interrupt_handler(14, page_fault_handler);
     // Register PIT handler
     register_interrupt_handler(32, pit_handler);
     // Register keyboard handler
@@ -153,19 +161,15 @@ void isr_install() {
 }
 
 // C-level handler called from assembly stubs
-void isr_handler_c(registers regs) {
+void isr_handler_c(registers* regs) {
     // If we have a custom handler, call it.
-    if (interrupt_handlers[regs.int_no] != 0) {
-        interrupt_handlers[regs.int_no](&regs);
+    if (interrupt_handlers[regs->int_no] != 0) {
+        interrupt_handlers[regs->int_no](regs);
     } else {
-        if (regs.int_no == 14) {
-            page_fault_handler(&regs);
-        }
-
-        if (regs.int_no < 32) {
+        if (regs->int_no < 32) {
             // CPU Exception
             serial_writestring("CPU Exception: ");
-            serial_writehex(regs.int_no);
+            serial_writehex(regs->int_no);
             serial_writestring("\n");
             // Halt on CPU exception
             asm volatile ("cli; hlt");
@@ -173,7 +177,7 @@ void isr_handler_c(registers regs) {
     }
     
     // For IRQs, we need to send an EOI to the PIC.
-    if (regs.int_no >= 32 && regs.int_no < 48) {
-        pic_send_eoi(regs.int_no - 32);
+    if (regs->int_no >= 32 && regs->int_no < 48) {
+        pic_send_eoi(regs->int_no - 32);
     }
 } 
\ No newline at end of file
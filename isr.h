@@ -13,6 +13,7 @@
 typedef struct {
     // Registers pushed by isr_common_stub
     uint64_t rdi, rsi, rbp, rbx, rdx, rcx, rax;
+    uint64_t r8, r9, r10, r11;
     
     // Pushed by ISR macro
     uint64_t int_no, err_code;
@@ -22,7 +23,8 @@ typedef struct {
 } registers;
 
 void isr_install();
-void isr_handler_c(registers regs);
+// Called by isr_common_stub with a pointer to the pushed register frame
+void isr_handler_c(registers* regs);
 void page_fault_handler(registers* regs);
 void register_interrupt_handler(uint8_t n, void (*handler)(registers*));
 
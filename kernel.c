@@ -14,6 +14,7 @@
 #include "pmm.h"
 #include "heap.h"
 #include "vmm.h"
+#include "vmalloc.h"
 #include "mouse.h"
 
 #include "vbe.h"
@@ -23,12 +24,30 @@
 #include "audio.h"
 #include "gui.h"
 #include "bochs_vbe.h"
+#include "cpu.h"
 
 // Compile-time toggle for boot animation delays
 #ifndef BOOT_ANIMATION
 #define BOOT_ANIMATION 0
 #endif
 
+// Compile-time toggle: run the PMM allocation benchmark once interrupts are up
+#ifndef PMM_BENCHMARK
+#define PMM_BENCHMARK 0
+#endif
+#define PMM_BENCHMARK_PAGES (1024 * 1024)
+
+// Compile-time toggle: time siv_present() with a plain vs write-combining LFB at boot
+#ifndef FB_BENCHMARK
+#define FB_BENCHMARK 0
+#endif
+#define FB_BENCHMARK_FRAMES 120
+
+// membench: each size is repeated for at least this long
+#define MEMBENCH_MIN_MS 50
+// strtest: random string cases checked against the byte-loop references
+#define STRTEST_ITERATIONS 100000
+
 struct framebuffer_info {
     uint32_t width;
     uint32_t height;
@@ -102,6 +121,28 @@ struct multiboot2_tag_vbe *find_vbe_tag(struct multiboot2_info *mbi) {
     return NULL;
 }
 
+// Collect physical ranges the PMM must never hand out: the multiboot info
+// itself, every loaded module (initrd) and the linear framebuffer.
+static size_t collect_boot_reservations(struct multiboot2_info *mbi, pmm_range_t* out, size_t max) {
+    size_t count = 0;
+    if (count < max) out[count++] = (pmm_range_t){ (uint64_t)(uintptr_t)mbi, mbi->total_size };
+    uint8_t* start = (uint8_t*)mbi + 8;
+    uint8_t* end = (uint8_t*)mbi + mbi->total_size;
+    for (struct multiboot2_tag *tag = (struct multiboot2_tag *)start;
+         (uint8_t*)tag < end && tag->size >= 8 && count < max;
+         tag = (struct multiboot2_tag *)((uint8_t *)tag + ((tag->size + 7) & ~7))) {
+        if (tag->type == MULTIBOOT2_TAG_TYPE_MODULE) {
+            struct multiboot2_tag_module *mod = (struct multiboot2_tag_module *)tag;
+            out[count++] = (pmm_range_t){ mod->mod_start, mod->mod_end - mod->mod_start };
+        } else if (tag->type == MULTIBOOT2_TAG_TYPE_FRAMEBUFFER) {
+            struct multiboot2_tag_framebuffer *fb = (struct multiboot2_tag_framebuffer *)tag;
+            out[count++] = (pmm_range_t){ fb->framebuffer_addr, (uint64_t)fb->framebuffer_pitch * fb->framebuffer_height };
+        }
+        if (tag->type == MULTIBOOT2_TAG_TYPE_END) break;
+    }
+    return count;
+}
+
 // VGA text mode colors
 #define VGA_BLACK 0
 #define VGA_BLUE 1
@@ -185,6 +226,8 @@ void terminal_writedec(size_t n);
 
 // Boot timing (PIT-based)
 static uint64_t boot_tick_start = 0;
+static uint64_t boot_tsc_start = 0;
+static uint64_t pmm_init_cycles = 0;
 
 static inline void boot_pause(int milliseconds) {
     if (BOOT_ANIMATION) {
@@ -227,7 +270,8 @@ static void shell_redraw_line_with_selection(void) {
 // Supported shell commands for autocomplete
 static const char* SHELL_COMMANDS[] = {
     "help", "clear", "echo", "info", "graphics", "ls", "cat", "touch", "rm",
-    "mkdir", "cd", "pwd", "meminfo", "heapinfo", "vbeinfo", "savefs", "beep", "play"
+    "mkdir", "cd", "pwd", "meminfo", "heapinfo", "vbeinfo", "savefs", "beep", "play",
+    "pmmbench", "heapprof", "membench", "strtest"
 };
 static const size_t NUM_SHELL_COMMANDS = sizeof(SHELL_COMMANDS) / sizeof(SHELL_COMMANDS[0]);
 
@@ -458,6 +502,56 @@ void shell_clear() {
     shell_prompt();
 }
 
+/* Print memcpy and memset throughput for 64 B, 4 KiB and 3 MiB blocks, the
+   sizes of small copies, pages and a 1024x768x32 frame. */
+static void mem_benchmark(void) {
+    static const size_t sizes[] = { 64, 4096, 3 * 1024 * 1024 };
+    static const char* const labels[] = { "64 B ", "4 KiB", "3 MiB" };
+    const size_t max = 3 * 1024 * 1024;
+    uint8_t* src = (uint8_t*)kmalloc(max);
+    uint8_t* dst = (uint8_t*)kmalloc(max);
+    if (!src || !dst) {
+        terminal_writestring("membench: out of memory\n");
+        kfree(src);
+        kfree(dst);
+        return;
+    }
+    memset(src, 0x5A, max);
+    memset(dst, 0, max);
+
+    terminal_writestring("Copy strategy: ");
+    terminal_writestring(string_copy_strategy());
+    terminal_writestring("\n");
+    for (int op = 0; op < 2; op++) {
+        for (int i = 0; i < 3; i++) {
+            size_t n = sizes[i];
+            uint64_t bytes = 0;
+            uint64_t t0 = pit_get_ticks();
+            uint64_t ms;
+            do {
+                for (int rep = 0; rep < 64; rep++) {
+                    if (op == 0) memcpy(dst, src, n);
+                    else memset(dst, rep, n);
+                }
+                bytes += 64 * (uint64_t)n;
+                ms = pit_get_ticks() - t0;
+            } while (ms < MEMBENCH_MIN_MS);
+
+            // bytes per ms / 10^6 = GB/s, printed with two decimals
+            uint64_t centi = bytes * 100 / ms / 1000000;
+            terminal_writestring(op == 0 ? "  memcpy " : "  memset ");
+            terminal_writestring(labels[i]);
+            terminal_writestring(": ");
+            terminal_writedec(centi / 100);
+            terminal_writestring(centi % 100 < 10 ? ".0" : ".");
+            terminal_writedec(centi % 100);
+            terminal_writestring(" GB/s\n");
+        }
+    }
+    kfree(src);
+    kfree(dst);
+}
+
 void shell_handle_command(const char* cmd) {
     if (strcmp(cmd, "help") == 0) {
         terminal_writestring("Available commands:\n");
@@ -473,12 +567,16 @@ void shell_handle_command(const char* cmd) {
         terminal_writestring(" - mkdir <dir>: Create directory\n");
         terminal_writestring(" - cd <dir>: Change directory\n");
         terminal_writestring(" - pwd: Print working directory\n");
-        terminal_writestring(" - meminfo: Show memory info\n");
+        terminal_writestring(" - meminfo: Show memory and fragmentation info\n");
         terminal_writestring(" - heapinfo: Show heap info\n");
         terminal_writestring(" - vbeinfo: Show VBE info\n");
         terminal_writestring(" - savefs: Dump current VFS as a tar stream over serial\n");
         terminal_writestring(" - beep [freq] [ms]: Play PC speaker tone\n");
         terminal_writestring(" - play <file>: Play audio file (WAV/MP3)\n");
+        terminal_writestring(" - pmmbench: Time 1M page alloc/free (results on serial)\n");
+        terminal_writestring(" - heapprof: Dump allocation sites and live allocations (serial)\n");
+        terminal_writestring(" - membench: memcpy/memset throughput at 64 B, 4 KiB and 3 MiB\n");
+        terminal_writestring(" - strtest: Check the word-at-a-time string functions\n");
         // vbeset is disabled while under development
     } else if (strcmp(cmd, "clear") == 0) {
         shell_clear();
@@ -726,6 +824,74 @@ void shell_handle_command(const char* cmd) {
         terminal_writestring("  Free:  ");
         terminal_writedec(info.free_pages * 4);
         terminal_writestring(" KB\n");
+        terminal_writestring("  Largest free block: ");
+        terminal_writedec(info.largest_free_block_pages * 4);
+        terminal_writestring(" KB\n");
+        terminal_writestring("  Longest free run: ");
+        terminal_writedec(info.longest_free_run_pages * 4);
+        terminal_writestring(" KB\n");
+        terminal_writestring("  Free blocks by order:");
+        for (int order = 0; order <= PMM_MAX_ORDER; order++) {
+            terminal_writestring(" ");
+            terminal_writedec(info.free_blocks[order]);
+        }
+        terminal_writestring("\n");
+        terminal_writestring("  2 MiB chunks: ");
+        terminal_writedec(info.empty_chunks);
+        terminal_writestring(" free, ");
+        terminal_writedec(info.total_chunks - info.empty_chunks - info.full_chunks);
+        terminal_writestring(" partial, ");
+        terminal_writedec(info.full_chunks);
+        terminal_writestring(" full (map on serial)\n");
+        terminal_writestring("  Zeroed page pool: ");
+        terminal_writedec(info.zero_pool_pages);
+        terminal_writestring(" pages\n");
+        vmalloc_info_t vinfo;
+        vmalloc_get_info(&vinfo);
+        terminal_writestring("  vmalloc: ");
+        terminal_writedec(vinfo.areas);
+        terminal_writestring(" areas, ");
+        terminal_writedec(vinfo.committed_bytes / 1024);
+        terminal_writestring(" of ");
+        terminal_writedec(vinfo.reserved_bytes / 1024);
+        terminal_writestring(" KB committed, ");
+        terminal_writedec(vinfo.faults);
+        terminal_writestring(" demand faults\n");
+        // Per-chunk map on serial: '.' free, '#' full, '0'-'9' tenths free
+        serial_writestring("[meminfo] chunk map:\n");
+        for (size_t c = 0; c < info.total_chunks; c++) {
+            size_t free = pmm_chunk_free_pages(c);
+            size_t pages = pmm_chunk_pages(c);
+            if (free == pages) serial_write('.');
+            else if (free == 0) serial_write('#');
+            else serial_write((char)('0' + (free * 10) / pages));
+            if ((c % 64) == 63) serial_write('\n');
+        }
+        serial_write('\n');
+    } else if (strcmp(cmd, "pmmbench") == 0) {
+        terminal_writestring("Running PMM benchmark, results on serial...\n");
+        pmm_benchmark(PMM_BENCHMARK_PAGES);
+    } else if (strcmp(cmd, "membench") == 0) {
+        mem_benchmark();
+    } else if (strcmp(cmd, "strtest") == 0) {
+        // A vmalloc page is followed by an unmapped guard page, so any read
+        // past the end of a test string faults instead of passing silently.
+        uint8_t* page = (uint8_t*)vmalloc(PAGE_SIZE);
+        if (!page) {
+            terminal_writestring("strtest: out of memory\n");
+        } else {
+            size_t failures = string_selftest(page, PAGE_SIZE, STRTEST_ITERATIONS);
+            terminal_writestring("strtest: ");
+            terminal_writedec(STRTEST_ITERATIONS);
+            terminal_writestring(" cases, ");
+            terminal_writedec(failures);
+            terminal_writestring(failures ? " mismatches\n" : " mismatches, OK\n");
+            vfree(page);
+        }
+    } else if (strcmp(cmd, "heapprof") == 0) {
+        terminal_writestring(HEAP_PROFILE ? "Heap profile written to serial.\n"
+                                          : "Heap profiler not built in (build with -DHEAP_PROFILE=1).\n");
+        heap_profile_dump();
     } else if (strcmp(cmd, "heapinfo") == 0) {
         heap_info_t info;
         heap_get_info(&info);
@@ -739,6 +905,33 @@ void shell_handle_command(const char* cmd) {
         terminal_writestring("  Free:  ");
         terminal_writedec(info.free_bytes);
         terminal_writestring(" bytes\n");
+        terminal_writestring("  Free blocks: ");
+        terminal_writedec(info.free_blocks);
+        terminal_writestring(", largest ");
+        terminal_writedec(info.largest_free_block);
+        terminal_writestring(" bytes, fragmentation ");
+        terminal_writedec(info.fragmentation_pct);
+        terminal_writestring("%\n");
+        terminal_writestring("  Pages returned to PMM: ");
+        terminal_writedec(info.released_pages);
+        terminal_writestring("\n");
+        terminal_writestring("  Large: ");
+        terminal_writedec(info.large_allocs);
+        terminal_writestring(" allocations, ");
+        terminal_writedec(info.large_bytes / 1024);
+        terminal_writestring(" KB\n");
+        terminal_writestring("  Slab classes (in use / capacity, slabs):\n");
+        for (int i = 0; i < HEAP_SLAB_CLASSES; i++) {
+            terminal_writestring("    ");
+            terminal_writedec(info.classes[i].object_size);
+            terminal_writestring(" B: ");
+            terminal_writedec(info.classes[i].objects_inuse);
+            terminal_writestring(" / ");
+            terminal_writedec(info.classes[i].objects_total);
+            terminal_writestring(", ");
+            terminal_writedec(info.classes[i].slabs);
+            terminal_writestring("\n");
+        }
     } else if (strcmp(cmd, "vbeinfo") == 0) {
         struct multiboot2_info *mbi = (struct multiboot2_info *)g_mb2_info_addr;
         struct multiboot2_tag_vbe *vbe_tag = find_vbe_tag(mbi);
@@ -1084,6 +1277,58 @@ void update_progress_bar(int percentage, const char* text) {
     siv_draw_text(fb_info.width / 2 - 200, fb_info.height / 2 + 25, text, 1.0f, 0xFFFFFFFF);
 }
 
+// Physical range of the active linear framebuffer, kept for fb_benchmark().
+static uint64_t fb_phys_addr = 0;
+static size_t fb_map_bytes = 0;
+
+/* Identity-map the linear framebuffer write-combining and remember where it is. */
+static bool map_framebuffer(uint64_t phys, size_t bytes) {
+    if (!vmm_map_range_wc(phys, bytes)) {
+        return false;
+    }
+    fb_phys_addr = phys;
+    fb_map_bytes = bytes;
+    return true;
+}
+
+/* Time FB_BENCHMARK_FRAMES full-screen siv_present() calls with the
+   framebuffer mapped plain (no PAT attribute) and then write-combining,
+   printing frames per second for both to serial. Needs the PIT running. */
+static void fb_benchmark(void) {
+    if (!graphics_initialized || fb_map_bytes == 0) {
+        serial_writestring("[fbbench] No framebuffer.\n");
+        return;
+    }
+    siv_enable_double_buffer(true);
+    for (int pass = 0; pass < 2; pass++) {
+        bool wc = (pass == 1);
+        if (wc) vmm_map_range_wc(fb_phys_addr, fb_map_bytes);
+        else vmm_identity_map_range(fb_phys_addr, fb_map_bytes, PAGE_PRESENT | PAGE_WRITABLE);
+
+        uint64_t t0 = pit_get_ticks();
+        uint64_t c0 = rdtsc();
+        for (int frame = 0; frame < FB_BENCHMARK_FRAMES; frame++) {
+            siv_mark_dirty(0, 0, (int)fb_info.width, (int)fb_info.height);
+            siv_present();
+        }
+        uint64_t cycles = rdtsc() - c0;
+        uint64_t ms = pit_get_ticks() - t0;
+        siv_present_stats_t stats;
+        siv_get_present_stats(&stats);
+
+        serial_writestring(wc ? "[fbbench] write-combining: " : "[fbbench] default mapping: ");
+        serial_writedec(ms ? (uint64_t)FB_BENCHMARK_FRAMES * 1000 / ms : 0);
+        serial_writestring(" fps, ");
+        serial_writedec(cycles / FB_BENCHMARK_FRAMES);
+        serial_writestring(" cycles/frame, ");
+        serial_writedec(stats.last_bytes);
+        serial_writestring(" bytes/frame\n");
+    }
+    // The splash draws straight to the framebuffer; put it back.
+    siv_enable_double_buffer(false);
+    draw_progress_bar_background();
+}
+
 void init_graphics(struct multiboot2_tag_framebuffer* fb_tag) {
     if (fb_tag->framebuffer_type == 2) {
         // Text framebuffer only; leave graphics disabled
@@ -1094,7 +1339,7 @@ void init_graphics(struct multiboot2_tag_framebuffer* fb_tag) {
 
     // Ensure framebuffer physical memory is identity-mapped before use
     size_t fb_bytes = (size_t)fb_tag->framebuffer_pitch * fb_tag->framebuffer_height;
-    if (!vmm_identity_map_range((uint64_t)fb_tag->framebuffer_addr, fb_bytes, PAGE_PRESENT | PAGE_WRITABLE)) {
+    if (!map_framebuffer((uint64_t)fb_tag->framebuffer_addr, fb_bytes)) {
         serial_writestring("VMM: Failed to map framebuffer. Graphics disabled.\n");
         graphics_initialized = false;
         return;
@@ -1135,7 +1380,7 @@ static void try_graphics_from_vbe(struct multiboot2_tag_vbe* vbe_tag) {
     vbe_mode_info_t* mi = (vbe_mode_info_t*)vbe_tag->vbe_mode_info;
     if (!mi) return;
     size_t fb_bytes = (size_t)mi->bytes_per_scan_line * (size_t)mi->y_resolution;
-    if (!vmm_identity_map_range((uint64_t)mi->phys_base_ptr, fb_bytes, PAGE_PRESENT | PAGE_WRITABLE)) {
+    if (!map_framebuffer((uint64_t)mi->phys_base_ptr, fb_bytes)) {
         serial_writestring("VMM: Failed to map VBE framebuffer.\n");
         return;
     }
@@ -1158,7 +1403,7 @@ static void try_graphics_bochs_dispi(uint16_t width, uint16_t height, uint16_t b
     uint64_t lfb_phys = 0xE0000000ULL;
     uint32_t pitch = (uint32_t)width * (bpp / 8);
     size_t fb_bytes = (size_t)pitch * (size_t)height;
-    if (!vmm_identity_map_range(lfb_phys, fb_bytes, PAGE_PRESENT | PAGE_WRITABLE)) {
+    if (!map_framebuffer(lfb_phys, fb_bytes)) {
         serial_writestring("VMM: Failed to map Bochs LFB.\n");
         return;
     }
@@ -1175,13 +1420,19 @@ static void try_graphics_bochs_dispi(uint16_t width, uint16_t height, uint16_t b
 void kernel_main(uint64_t multiboot_info_addr) {
     g_mb2_info_addr = multiboot_info_addr;
     serial_init();
+    string_init();
     serial_writestring("Serial Initialized\n");
 
     struct multiboot2_info *mbi = (struct multiboot2_info *)multiboot_info_addr;
     
     struct multiboot2_tag_mmap *mmap_tag = find_mmap_tag(mbi);
     if (mmap_tag) {
-        if (!pmm_init(mmap_tag)) {
+        pmm_range_t reserved[PMM_MAX_RESERVED];
+        size_t reserved_count = collect_boot_reservations(mbi, reserved, PMM_MAX_RESERVED);
+        uint64_t tsc_before = rdtsc();
+        bool pmm_ok = pmm_init(mmap_tag, reserved, reserved_count);
+        pmm_init_cycles = rdtsc() - tsc_before;
+        if (!pmm_ok) {
             serial_writestring("PMM initialization failed. Halting.\n");
             asm ("cli; hlt");
         }
@@ -1191,9 +1442,12 @@ void kernel_main(uint64_t multiboot_info_addr) {
         return;
     }
 
-    heap_init();
+    // The VMM builds the direct map the heap allocates through, then the
+    // PMM can hand out RAM above the 4 GiB boot identity map.
+    vmm_init(mmap_tag);
+    pmm_release_high_memory();
 
-    vmm_init();
+    heap_init();
 
     struct multiboot2_tag_framebuffer *fb_tag = find_framebuffer_tag(mbi);
     struct multiboot2_tag_vbe *vbe_tag = find_vbe_tag(mbi);
@@ -1242,7 +1496,14 @@ void kernel_main(uint64_t multiboot_info_addr) {
     pit_init(1000);
     pic_unmask_irq(0);
     sti();
+    if (PMM_BENCHMARK) {
+        pmm_benchmark(PMM_BENCHMARK_PAGES);
+    }
+    if (FB_BENCHMARK) {
+        fb_benchmark();
+    }
     boot_tick_start = pit_get_ticks();
+    boot_tsc_start = rdtsc();
     update_progress_bar(40, "Interrupts enabled.");
     boot_pause(500);
     
@@ -1280,8 +1541,19 @@ void kernel_main(uint64_t multiboot_info_addr) {
             while (v > 0) { tmp[t++] = (char)('0' + (v % 10)); v /= 10; }
             while (t--) buf[i++] = tmp[t];
         }
-        buf[i++] = ' '; buf[i++] = 'm'; buf[i++] = 's'; buf[i++] = '\n'; buf[i] = '\0';
+        buf[i++] = ' '; buf[i++] = 'm'; buf[i++] = 's'; buf[i] = '\0';
         serial_writestring(buf);
+        // PMM init runs before the PIT, so it is timed in TSC cycles and
+        // converted using the TSC rate measured over the PIT-timed boot.
+        serial_writestring(" (PMM init: ");
+        uint64_t tsc_per_ms = boot_ms ? (rdtsc() - boot_tsc_start) / boot_ms : 0;
+        if (tsc_per_ms) {
+            serial_writedec(pmm_init_cycles * 1000 / tsc_per_ms);
+            serial_writestring(" us)\n");
+        } else {
+            serial_writedec(pmm_init_cycles);
+            serial_writestring(" cycles)\n");
+        }
     }
     boot_pause(1000);
 
@@ -1298,6 +1570,7 @@ void kernel_main(uint64_t multiboot_info_addr) {
     // Enter idle loop
     while (1) {
         if (gui_is_active()) gui_update();
+        pmm_zero_pool_refill();
         asm("hlt");
     }
 }
\ No newline at end of file
@@ -7,4 +7,27 @@
 #define PHYS_TO_VIRT(p) ((p) + KERNEL_HH_BASE)
 #define VIRT_TO_PHYS(v) ((v) - KERNEL_HH_BASE)
 
-#endif 
\ No newline at end of file
+// vmm_init() maps the RAM ranges of the memory map linearly at PHYS_MAP_BASE
+// (PML4 slot 256). phys_map_size is the end of the highest one, 0 until then;
+// holes below it (MMIO, the framebuffer) are left out of the map.
+#define PHYS_MAP_BASE 0xFFFF800000000000ULL
+extern uint64_t phys_map_size;
+
+/* Pointer through which the kernel can reach RAM at physical address phys,
+   such as anything the PMM hands out. Before the direct map exists, and for
+   addresses above RAM, this is the boot identity mapping of the low 4 GiB.
+   MMIO in a hole below phys_map_size has no direct-map address; map it
+   separately (vmm_map_range_wc() for framebuffers). */
+static inline void* phys_to_virt(uint64_t phys) {
+    if (phys < phys_map_size) return (void*)(phys + PHYS_MAP_BASE);
+    return (void*)phys;
+}
+
+/* Inverse of phys_to_virt(); identity-mapped pointers translate to themselves. */
+static inline uint64_t virt_to_phys(const void* virt) {
+    uint64_t addr = (uint64_t)virt;
+    if (addr >= PHYS_MAP_BASE && addr - PHYS_MAP_BASE < phys_map_size) return addr - PHYS_MAP_BASE;
+    return addr;
+}
+
+#endif
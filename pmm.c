@@ -3,38 +3,383 @@
 #include "pmm.h"
 #include "serial.h"
 #include "string.h"
+#include "pit.h"
+#include "cpu.h"
+#include "mem.h"
 #include <stdbool.h>
 
-#define PMM_BASE 0x1000000UL // Start at 16MB (after kernel)
-#define PMM_MAX  0x40000000UL // Up to 1GB for demo
 #define PAGE_SIZE 4096
 
-static uint64_t pmm_next_free = PMM_BASE;
-static uint8_t* bitmap = NULL;
+#define BITS_PER_WORD 64
+#define PMM_BENCH_BATCH 1024
+#define PMM_NO_PAGE 0xFFFFFFFFu   // End-of-list marker for the buddy free lists
+#define PMM_ORDER_NONE 0xFF       // buddy_order[] value for pages that are not a free block head
+#define WORDS_PER_CHUNK (PMM_CHUNK_PAGES / BITS_PER_WORD)
+#define PMM_IDENTITY_LIMIT 0x100000000ULL // kernel_entry.asm identity-maps the first 4 GiB
+
+// Physical base of the metadata area holding the bitmap, the buddy side
+// arrays and the chunk counters. The pointers below are derived from it with
+// phys_to_virt(), again once the direct map exists.
+static uint64_t meta_phys = 0;
+
+// One bit per page (1 = used). Allocation goes through the buddy free lists;
+// the bitmap answers "is this page in use" for frees, claims and accounting.
+static uint64_t* bitmap = NULL;
 static size_t total_pages = 0;
-static size_t last_alloc_index = 0;
+static size_t bitmap_words = 0;
+
+// Accounting kept current by every bitmap update so queries never rescan.
+static size_t free_page_count = 0;
+static uint16_t* chunk_free = NULL;   // free pages per PMM_CHUNK_PAGES chunk
+static size_t total_chunks = 0;
+static size_t empty_chunks = 0;       // chunks with every page free
+static size_t full_chunks = 0;        // chunks with no page free
+
+// Free runs inside each chunk: from its first page, up to its last page, and
+// the longest anywhere in it. A chunk is rescanned only when pmm_get_info()
+// finds it dirty, and the chunks are only combined again if any changed.
+typedef struct {
+    uint16_t lead;
+    uint16_t trail;
+    uint16_t longest;
+    uint16_t dirty;
+} chunk_runs_t;
+static chunk_runs_t* chunk_runs = NULL;
+static bool runs_dirty = false;
+static size_t longest_free_run = 0;
+
+// Buddy allocator state. Free blocks of 2^order pages are kept on per-order
+// doubly-linked lists threaded through page-indexed side arrays, so nothing is
+// ever written into free memory itself. The bitmap above mirrors the same state
+// one bit per page and is kept in sync on every alloc/free.
+static uint32_t* buddy_next = NULL;
+static uint32_t* buddy_prev = NULL;
+static uint8_t* buddy_order = NULL;
+static uint32_t free_list[PMM_MAX_ORDER + 1];
+static size_t free_blocks[PMM_MAX_ORDER + 1];
+
+// Single pages zeroed ahead of time by pmm_zero_pool_refill(), stored by page
+// number. They count as used until handed out or drained back on OOM.
+static uint32_t zero_pool[PMM_ZERO_POOL_PAGES];
+static size_t zero_pool_count = 0;
+
+// Kept from pmm_init() so RAM above the identity map can be released once
+// the direct map reaches it. Physical, like the metadata.
+static uint64_t boot_mmap_phys = 0;
+static pmm_range_t kept_reserved[PMM_MAX_RESERVED + 2];
+static size_t kept_reserved_count = 0;
+static uint64_t released_limit = 0;   // available RAM below this has been released
 
 extern uint8_t _kernel_end[];
 
+/* Move chunk c's free count by delta, keeping the empty/full chunk totals in
+   step as the count reaches or leaves 0 and the chunk's size. */
+static void chunk_add_free(size_t c, long delta) {
+    size_t pages = pmm_chunk_pages(c);
+    if (chunk_free[c] == 0) full_chunks--;
+    else if (chunk_free[c] == pages) empty_chunks--;
+    chunk_free[c] = (uint16_t)(chunk_free[c] + delta);
+    if (chunk_free[c] == 0) full_chunks++;
+    else if (chunk_free[c] == pages) empty_chunks++;
+    chunk_runs[c].dirty = 1;
+    runs_dirty = true;
+}
+
+/* Recount chunk c's free runs from the bitmap, skipping over whole runs of
+   free or used bits with ctz. Bits past total_pages stay set, so the short
+   last chunk needs no special case. */
+static void chunk_scan_runs(size_t c) {
+    size_t run = 0, lead = 0, longest = 0;
+    bool lead_done = false;
+    const uint64_t* words = bitmap + c * WORDS_PER_CHUNK;
+    size_t word_count = (pmm_chunk_pages(c) + BITS_PER_WORD - 1) / BITS_PER_WORD;
+
+    for (size_t i = 0; i < word_count; i++) {
+        uint64_t used = words[i];
+        unsigned int bit = 0;
+        while (bit < BITS_PER_WORD) {
+            if ((used >> bit) == 0) {
+                run += BITS_PER_WORD - bit;
+                break;
+            }
+            // Free pages up to the next used one end the current run...
+            unsigned int free_bits = __builtin_ctzll(used >> bit);
+            run += free_bits;
+            if (!lead_done) {
+                lead = run;
+                lead_done = true;
+            }
+            if (run > longest) longest = run;
+            run = 0;
+            bit += free_bits;
+            // ...and the used pages after them are skipped in one step.
+            bit += __builtin_ctzll(~(used >> bit));
+        }
+    }
+    if (!lead_done) lead = run;
+    if (run > longest) longest = run;
+
+    chunk_runs[c].lead = (uint16_t)lead;
+    chunk_runs[c].trail = (uint16_t)run;
+    chunk_runs[c].longest = (uint16_t)longest;
+    chunk_runs[c].dirty = 0;
+}
+
+/* Longest run of free pages anywhere, joining runs across chunk borders. */
+static size_t pmm_longest_free_run(void) {
+    if (!runs_dirty) return longest_free_run;
+
+    size_t best = 0, run = 0;
+    for (size_t c = 0; c < total_chunks; c++) {
+        if (chunk_free[c] == pmm_chunk_pages(c)) {
+            run += chunk_free[c];
+            continue;
+        }
+        if (chunk_runs[c].dirty) chunk_scan_runs(c);
+        run += chunk_runs[c].lead;
+        if (run > best) best = run;
+        if (chunk_runs[c].longest > best) best = chunk_runs[c].longest;
+        run = chunk_runs[c].trail;
+    }
+    if (run > best) best = run;
+
+    longest_free_run = best;
+    runs_dirty = false;
+    return best;
+}
+
 void bitmap_set(size_t bit) {
-    bitmap[bit / 8] |= (1 << (bit % 8));
+    size_t word = bit / BITS_PER_WORD;
+    uint64_t mask = 1ULL << (bit % BITS_PER_WORD);
+    if (bitmap[word] & mask) return;
+    bitmap[word] |= mask;
+    free_page_count--;
+    chunk_add_free(word / WORDS_PER_CHUNK, -1);
 }
 
 void bitmap_clear(size_t bit) {
-    bitmap[bit / 8] &= ~(1 << (bit % 8));
+    size_t word = bit / BITS_PER_WORD;
+    uint64_t mask = 1ULL << (bit % BITS_PER_WORD);
+    if (!(bitmap[word] & mask)) return;
+    bitmap[word] &= ~mask;
+    free_page_count++;
+    chunk_add_free(word / WORDS_PER_CHUNK, 1);
 }
 
 bool bitmap_test(size_t bit) {
-    return bitmap[bit / 8] & (1 << (bit % 8));
+    return bitmap[bit / BITS_PER_WORD] & (1ULL << (bit % BITS_PER_WORD));
+}
+
+/* Mark [first, first+count) used, a whole word at a time where aligned. */
+static void bitmap_set_range(size_t first, size_t count) {
+    while (count && (first % BITS_PER_WORD)) {
+        bitmap_set(first++);
+        count--;
+    }
+    while (count >= BITS_PER_WORD) {
+        size_t word = first / BITS_PER_WORD;
+        size_t freed = BITS_PER_WORD - __builtin_popcountll(bitmap[word]);
+        free_page_count -= freed;
+        chunk_add_free(word / WORDS_PER_CHUNK, -(long)freed);
+        bitmap[word] = ~0ULL;
+        first += BITS_PER_WORD;
+        count -= BITS_PER_WORD;
+    }
+    while (count--) {
+        bitmap_set(first++);
+    }
+}
+
+/* Mark [first, first+count) free, a whole word at a time where aligned. */
+static void bitmap_clear_range(size_t first, size_t count) {
+    while (count && (first % BITS_PER_WORD)) {
+        bitmap_clear(first++);
+        count--;
+    }
+    while (count >= BITS_PER_WORD) {
+        size_t word = first / BITS_PER_WORD;
+        size_t used = __builtin_popcountll(bitmap[word]);
+        free_page_count += used;
+        chunk_add_free(word / WORDS_PER_CHUNK, (long)used);
+        bitmap[word] = 0;
+        first += BITS_PER_WORD;
+        count -= BITS_PER_WORD;
+    }
+    while (count--) {
+        bitmap_clear(first++);
+    }
+}
+
+static void buddy_push(uint32_t page, unsigned int order) {
+    buddy_order[page] = (uint8_t)order;
+    buddy_prev[page] = PMM_NO_PAGE;
+    buddy_next[page] = free_list[order];
+    if (free_list[order] != PMM_NO_PAGE) {
+        buddy_prev[free_list[order]] = page;
+    }
+    free_list[order] = page;
+    free_blocks[order]++;
+}
+
+static void buddy_remove(uint32_t page, unsigned int order) {
+    if (buddy_prev[page] != PMM_NO_PAGE) {
+        buddy_next[buddy_prev[page]] = buddy_next[page];
+    } else {
+        free_list[order] = buddy_next[page];
+    }
+    if (buddy_next[page] != PMM_NO_PAGE) {
+        buddy_prev[buddy_next[page]] = buddy_prev[page];
+    }
+    buddy_order[page] = PMM_ORDER_NONE;
+    free_blocks[order]--;
 }
 
-bool pmm_init(struct multiboot2_tag_mmap* mmap_tag) {
+/* Push a block onto the free lists, merging with its buddy while the buddy is
+   a free block of the same order. The block's bitmap bits must already be clear. */
+static void buddy_insert_block(uint32_t page, unsigned int order) {
+    while (order < PMM_MAX_ORDER) {
+        uint32_t buddy = page ^ (1u << order);
+        if (buddy >= total_pages || buddy_order[buddy] != order) {
+            break;
+        }
+        buddy_remove(buddy, order);
+        if (buddy < page) page = buddy;
+        order++;
+    }
+    buddy_push(page, order);
+}
+
+/* Return a block to the free lists. */
+static void buddy_free_block(uint32_t page, unsigned int order) {
+    bitmap_clear_range(page, (size_t)1 << order);
+    buddy_insert_block(page, order);
+}
+
+/* Largest naturally aligned order that starts at `first` and fits in `count` pages. */
+static unsigned int buddy_fit_order(size_t first, size_t count) {
+    unsigned int order = first ? (unsigned int)__builtin_ctzll(first) : PMM_MAX_ORDER;
+    if (order > PMM_MAX_ORDER) order = PMM_MAX_ORDER;
+    while (((size_t)1 << order) > count) order--;
+    return order;
+}
+
+/* Free [first, first+count) as the largest naturally aligned blocks that fit. */
+static void buddy_free_range(size_t first, size_t count) {
+    while (count) {
+        unsigned int order = buddy_fit_order(first, count);
+        buddy_free_block((uint32_t)first, order);
+        first += (size_t)1 << order;
+        count -= (size_t)1 << order;
+    }
+}
+
+static unsigned int pmm_order_for_pages(size_t pages) {
+    unsigned int order = 0;
+    while (((size_t)1 << order) < pages) order++;
+    return order;
+}
+
+/* Boot-time release of [first, first+count), which must still be all used:
+   whole bitmap words are cleared with memset and the counters
+   are bumped arithmetically, so only the partial edge words go bit by bit. */
+static void pmm_release_range(size_t first, size_t count) {
+    size_t end = first + count;
+    size_t word_first = (first + BITS_PER_WORD - 1) / BITS_PER_WORD;
+    size_t word_end = end / BITS_PER_WORD;
+
+    if (word_first >= word_end) {
+        for (size_t bit = first; bit < end; bit++) bitmap_clear(bit);
+    } else {
+        for (size_t bit = first; bit < word_first * BITS_PER_WORD; bit++) bitmap_clear(bit);
+        for (size_t bit = word_end * BITS_PER_WORD; bit < end; bit++) bitmap_clear(bit);
+
+        memset(&bitmap[word_first], 0, (word_end - word_first) * sizeof(uint64_t));
+
+        size_t page = word_first * BITS_PER_WORD;
+        size_t page_end = word_end * BITS_PER_WORD;
+        free_page_count += page_end - page;
+        while (page < page_end) {
+            size_t chunk_end = (page / PMM_CHUNK_PAGES + 1) * PMM_CHUNK_PAGES;
+            if (chunk_end > page_end) chunk_end = page_end;
+            chunk_add_free(page / PMM_CHUNK_PAGES, (long)(chunk_end - page));
+            page = chunk_end;
+        }
+    }
+
+    while (count) {
+        unsigned int order = buddy_fit_order(first, count);
+        buddy_insert_block((uint32_t)first, order);
+        first += (size_t)1 << order;
+        count -= (size_t)1 << order;
+    }
+}
+
+/* Advance *start past any reserved range covering it and return the end of
+   the free piece that begins there (bounded by end). */
+static uint64_t pmm_next_free_piece(uint64_t* start, uint64_t end, const pmm_range_t* reserved, size_t reserved_count) {
+    bool moved = true;
+    while (moved && *start < end) {
+        moved = false;
+        for (size_t i = 0; i < reserved_count; i++) {
+            uint64_t r_start = reserved[i].base & ~(uint64_t)(PAGE_SIZE - 1);
+            uint64_t r_end = (reserved[i].base + reserved[i].length + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+            if (*start >= r_start && *start < r_end) {
+                *start = r_end;
+                moved = true;
+            }
+        }
+    }
+    uint64_t piece_end = end;
+    for (size_t i = 0; i < reserved_count; i++) {
+        uint64_t r_start = reserved[i].base & ~(uint64_t)(PAGE_SIZE - 1);
+        if (r_start > *start && r_start < piece_end) piece_end = r_start;
+    }
+    return piece_end;
+}
+
+/* One pass over the map: release each available region between
+   released_limit and limit minus the reserved ranges, a whole piece at a time. */
+static void pmm_release_available(uint64_t limit) {
+    struct multiboot2_tag_mmap* boot_mmap = (struct multiboot2_tag_mmap*)phys_to_virt(boot_mmap_phys);
+    for (struct multiboot2_mmap_entry* mmap = boot_mmap->entries;
+         (uint8_t*)mmap < (uint8_t*)boot_mmap + boot_mmap->size;
+         mmap = (struct multiboot2_mmap_entry*)((uint8_t*)mmap + boot_mmap->entry_size)) {
+
+        if (mmap->type == MULTIBOOT2_MEMORY_AVAILABLE) {
+            uint64_t start = (mmap->addr + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+            uint64_t end = (mmap->addr + mmap->len) & ~(uint64_t)(PAGE_SIZE - 1);
+            if (start < released_limit) start = released_limit;
+            if (end > limit) end = limit;
+            while (start < end) {
+                uint64_t piece_end = pmm_next_free_piece(&start, end, kept_reserved, kept_reserved_count);
+                if (start < piece_end) {
+                    pmm_release_range(start / PAGE_SIZE, (piece_end - start) / PAGE_SIZE);
+                }
+                start = piece_end;
+            }
+        }
+    }
+    if (limit > released_limit) released_limit = limit;
+}
+
+/* Point bitmap and the side arrays into the metadata area through whatever
+   phys_to_virt() reaches it with right now. */
+static void pmm_map_metadata(void) {
+    bitmap = (uint64_t*)phys_to_virt(meta_phys);
+    buddy_next = (uint32_t*)(bitmap + bitmap_words);
+    buddy_prev = buddy_next + total_pages;
+    buddy_order = (uint8_t*)(buddy_prev + total_pages);
+    chunk_free = (uint16_t*)(((uintptr_t)(buddy_order + total_pages) + 1) & ~(uintptr_t)1);
+    chunk_runs = (chunk_runs_t*)(chunk_free + total_chunks);
+}
+
+bool pmm_init(struct multiboot2_tag_mmap* mmap_tag, const pmm_range_t* boot_reserved, size_t boot_reserved_count) {
     uint64_t highest_addr = 0;
 
     for (struct multiboot2_mmap_entry* mmap = mmap_tag->entries;
          (uint8_t*)mmap < (uint8_t*)mmap_tag + mmap_tag->size;
          mmap = (struct multiboot2_mmap_entry*)((uint8_t*)mmap + mmap_tag->entry_size)) {
-        
+
         if (mmap->type == MULTIBOOT2_MEMORY_AVAILABLE) {
             uint64_t top = mmap->addr + mmap->len;
             if (top > highest_addr) {
@@ -43,9 +388,19 @@ bool pmm_init(struct multiboot2_tag_mmap* mmap_tag) {
         }
     }
 
+    // Page numbers are 32-bit in the buddy side arrays: 16 TiB at most.
+    if (highest_addr > (uint64_t)PMM_NO_PAGE * PAGE_SIZE) {
+        highest_addr = (uint64_t)PMM_NO_PAGE * PAGE_SIZE;
+    }
+
     total_pages = highest_addr / PAGE_SIZE;
-    size_t bitmap_size = (total_pages + 7) / 8;
-    
+    bitmap_words = (total_pages + BITS_PER_WORD - 1) / BITS_PER_WORD;
+    total_chunks = (total_pages + PMM_CHUNK_PAGES - 1) / PMM_CHUNK_PAGES;
+    // Bitmap, the buddy side arrays and the chunk counters share one metadata area.
+    size_t bitmap_size = bitmap_words * sizeof(uint64_t)
+                       + total_pages * (2 * sizeof(uint32_t) + sizeof(uint8_t))
+                       + total_chunks * (sizeof(uint16_t) + sizeof(chunk_runs_t)) + sizeof(uint16_t);
+
     uint64_t kernel_end_addr = (uint64_t)_kernel_end;
     uint64_t bitmap_search_start = (kernel_end_addr + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
 
@@ -56,114 +411,306 @@ bool pmm_init(struct multiboot2_tag_mmap* mmap_tag) {
     serial_writehex(bitmap_search_start);
     serial_writestring("\n");
 
+    // Everything below the kernel end (low memory and the kernel image), the
+    // caller's boot ranges and, once placed, the metadata area stay reserved.
+    pmm_range_t* reserved = kept_reserved;
+    size_t reserved_count = 0;
+    reserved[reserved_count++] = (pmm_range_t){ 0, bitmap_search_start };
+    for (size_t i = 0; i < boot_reserved_count && i < PMM_MAX_RESERVED; i++) {
+        reserved[reserved_count++] = boot_reserved[i];
+    }
+
     for (struct multiboot2_mmap_entry* mmap = mmap_tag->entries;
-         (uint8_t*)mmap < (uint8_t*)mmap_tag + mmap_tag->size;
+         meta_phys == 0 && (uint8_t*)mmap < (uint8_t*)mmap_tag + mmap_tag->size;
          mmap = (struct multiboot2_mmap_entry*)((uint8_t*)mmap + mmap_tag->entry_size)) {
-        
+
         if (mmap->type == MULTIBOOT2_MEMORY_AVAILABLE) {
-            uint64_t region_start = mmap->addr;
-            uint64_t region_len = mmap->len;
-
-            if (region_start < bitmap_search_start) {
-                if (region_start + region_len > bitmap_search_start) {
-                    uint64_t new_len = region_start + region_len - bitmap_search_start;
-                    if (new_len >= bitmap_size) {
-                        bitmap = (uint8_t*)bitmap_search_start;
-                        break; 
-                    }
-                }
-            } else {
-                if (region_len >= bitmap_size) {
-                    bitmap = (uint8_t*)region_start;
+            uint64_t start = (mmap->addr + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+            uint64_t end = (mmap->addr + mmap->len) & ~(uint64_t)(PAGE_SIZE - 1);
+            // The metadata is used before the direct map exists, through the
+            // boot identity map.
+            if (end > PMM_IDENTITY_LIMIT) end = PMM_IDENTITY_LIMIT;
+            while (start < end) {
+                uint64_t piece_end = pmm_next_free_piece(&start, end, reserved, reserved_count);
+                if (start < piece_end && piece_end - start >= bitmap_size) {
+                    meta_phys = start;
                     break;
                 }
+                start = piece_end;
             }
         }
     }
 
-    if (bitmap == NULL) {
+    if (meta_phys == 0) {
         serial_writestring("Error: Could not find a suitable location for the PMM bitmap.\n");
         return false;
     }
+    reserved[reserved_count++] = (pmm_range_t){ meta_phys, bitmap_size };
 
-    memset(bitmap, 0xFF, bitmap_size); // Mark all pages as used initially
-
-    for (struct multiboot2_mmap_entry* mmap = mmap_tag->entries;
-         (uint8_t*)mmap < (uint8_t*)mmap_tag + mmap_tag->size;
-         mmap = (struct multiboot2_mmap_entry*)((uint8_t*)mmap + mmap_tag->entry_size)) {
-        
-        if (mmap->type == MULTIBOOT2_MEMORY_AVAILABLE) {
-            for (uint64_t i = 0; i < mmap->len; i += PAGE_SIZE) {
-                pmm_free_page((void*)(mmap->addr + i));
-            }
-        }
-    }
-    
-    uintptr_t bitmap_addr = (uintptr_t)bitmap;
-    size_t bitmap_pages = (bitmap_size + PAGE_SIZE - 1) / PAGE_SIZE;
-    for (size_t i = 0; i < bitmap_pages; i++) {
-        void* page_to_alloc = (void*)(bitmap_addr + i * PAGE_SIZE);
-        size_t bit = (uint64_t)page_to_alloc / PAGE_SIZE;
-        if(bit < total_pages) {
-            bitmap_set(bit);
-        }
+    pmm_map_metadata();
+    memset(bitmap, 0xFF, bitmap_words * sizeof(uint64_t)); // Mark all pages as used initially
+    memset(buddy_order, PMM_ORDER_NONE, total_pages);
+    memset(chunk_free, 0, total_chunks * sizeof(uint16_t));
+    memset(chunk_runs, 0, total_chunks * sizeof(chunk_runs_t));
+    runs_dirty = false;
+    longest_free_run = 0;
+    empty_chunks = 0;
+    full_chunks = total_chunks;
+    free_page_count = 0;
+    for (unsigned int order = 0; order <= PMM_MAX_ORDER; order++) {
+        free_list[order] = PMM_NO_PAGE;
+        free_blocks[order] = 0;
     }
 
+    kept_reserved_count = reserved_count;
+    boot_mmap_phys = virt_to_phys(mmap_tag);
+
+    // Only the identity-mapped low 4 GiB for now; pmm_release_high_memory()
+    // adds the rest once vmm_init() has mapped it.
+    pmm_release_available(highest_addr < PMM_IDENTITY_LIMIT ? highest_addr : PMM_IDENTITY_LIMIT);
+
     serial_writestring("[Serial] PMM Initialized\n");
     return true;
 }
 
-void* pmm_alloc_page() {
-    for (size_t i = 0; i < total_pages; i++) {
-        size_t current_index = (last_alloc_index + i) % total_pages;
-        if (!bitmap_test(current_index)) {
-            bitmap_set(current_index);
-            last_alloc_index = current_index + 1;
-            return (void*)(current_index * PAGE_SIZE);
-        }
+/* Move the metadata accesses onto the direct map, then release the available
+   RAM above the boot identity map that it now covers. Until this runs those
+   pages stay marked used. */
+void pmm_release_high_memory(void) {
+    if (meta_phys == 0) return;
+    pmm_map_metadata();
+    uint64_t limit = phys_map_size;
+    if (limit > (uint64_t)total_pages * PAGE_SIZE) limit = (uint64_t)total_pages * PAGE_SIZE;
+    if (limit <= released_limit) return;
+
+    size_t before = free_page_count;
+    pmm_release_available(limit);
+    serial_writestring("[Serial] PMM: released ");
+    serial_writedec((free_page_count - before) / 256);
+    serial_writestring(" MiB above 4 GiB\n");
+}
+
+/* Give every pooled zero page back to the buddy lists. */
+static void pmm_zero_pool_drain(void) {
+    while (zero_pool_count) {
+        buddy_free_block(zero_pool[--zero_pool_count], 0);
+    }
+}
+
+void* pmm_alloc_pages(unsigned int order) {
+    if (order > PMM_MAX_ORDER) {
+        return NULL;
+    }
+
+    // Take the smallest free block that fits and split it down, returning the
+    // upper halves to the lower-order lists.
+    unsigned int current = order;
+    while (current <= PMM_MAX_ORDER && free_list[current] == PMM_NO_PAGE) {
+        current++;
+    }
+    if (current > PMM_MAX_ORDER && zero_pool_count) {
+        // Last resort: the zero pool is only a cache.
+        pmm_zero_pool_drain();
+        return pmm_alloc_pages(order);
     }
-    // Fallback to bump allocator region if bitmap says OOM
-    void* fallback = pmm_alloc(PAGE_SIZE);
-    if (fallback) {
-        serial_writestring("[Serial] PMM: Bitmap OOM, using bump region.\n");
-        return fallback;
+    if (current > PMM_MAX_ORDER) {
+        serial_writestring("[Serial] PMM: Out of memory\n");
+        return NULL;
     }
-    serial_writestring("[Serial] PMM: Out of memory\n");
-    return NULL; // Out of memory
+
+    uint32_t page = free_list[current];
+    buddy_remove(page, current);
+    while (current > order) {
+        current--;
+        buddy_push(page + (1u << current), current);
+    }
+
+    bitmap_set_range(page, (size_t)1 << order);
+    return (void*)((uint64_t)page * PAGE_SIZE);
+}
+
+void pmm_free_pages(void* addr, unsigned int order) {
+    if (addr == NULL || (uint64_t)addr < 0x100000 || order > PMM_MAX_ORDER) return;
+    size_t page = (uint64_t)addr / PAGE_SIZE;
+    if (page + ((size_t)1 << order) > total_pages) return;
+    if (!bitmap_test(page)) {
+        serial_writestring("[Serial] PMM: Double free of page ");
+        serial_writehex((uint64_t)addr);
+        serial_writestring("\n");
+        return;
+    }
+    buddy_free_block((uint32_t)page, order);
+}
+
+void* pmm_alloc_page() {
+    return pmm_alloc_pages(0);
 }
 
 void pmm_free_page(void* page) {
-    if (page == NULL || (uint64_t)page < 0x100000) return;
-    size_t bit = (uint64_t)page / PAGE_SIZE;
-    if (bit < total_pages) {
-        bitmap_clear(bit);
+    pmm_free_pages(page, 0);
+}
+
+/* Hand out a zeroed page, from the pool when it has one. */
+void* pmm_alloc_zeroed_page(void) {
+    if (zero_pool_count) {
+        return (void*)((uint64_t)zero_pool[--zero_pool_count] * PAGE_SIZE);
+    }
+    void* page = pmm_alloc_pages(0);
+    if (page) memset(phys_to_virt((uint64_t)page), 0, PAGE_SIZE);
+    return page;
+}
+
+/* Top the zero pool up by at most PMM_ZERO_REFILL_BATCH pages. Meant for the
+   idle loop, so each call stays short and it never dips into the last free pages. */
+void pmm_zero_pool_refill(void) {
+    for (unsigned int i = 0; i < PMM_ZERO_REFILL_BATCH; i++) {
+        if (zero_pool_count == PMM_ZERO_POOL_PAGES || free_page_count <= PMM_ZERO_POOL_PAGES) {
+            return;
+        }
+        void* page = pmm_alloc_pages(0);
+        if (page == NULL) return;
+        memset(phys_to_virt((uint64_t)page), 0, PAGE_SIZE);
+        zero_pool[zero_pool_count++] = (uint32_t)((uint64_t)page / PAGE_SIZE);
     }
 }
 
 void pmm_get_info(pmm_info_t* info) {
     if (!info) return;
 
-    size_t used_pages = 0;
-    for (size_t i = 0; i < total_pages; i++) {
-        if (bitmap_test(i)) {
-            used_pages++;
-        }
+    info->total_pages = total_pages;
+    info->free_pages = free_page_count;
+    info->used_pages = total_pages - free_page_count;
+    info->zero_pool_pages = zero_pool_count;
+
+    info->largest_free_block_pages = 0;
+    for (unsigned int order = 0; order <= PMM_MAX_ORDER; order++) {
+        info->free_blocks[order] = free_blocks[order];
+        if (free_blocks[order]) info->largest_free_block_pages = (size_t)1 << order;
     }
+    info->longest_free_run_pages = pmm_longest_free_run();
 
-    info->total_pages = total_pages;
-    info->used_pages = used_pages;
-    info->free_pages = total_pages - used_pages;
+    info->total_chunks = total_chunks;
+    info->empty_chunks = empty_chunks;
+    info->full_chunks = full_chunks;
+}
+
+size_t pmm_chunk_pages(size_t chunk) {
+    if (chunk >= total_chunks) return 0;
+    size_t first = chunk * PMM_CHUNK_PAGES;
+    return (total_pages - first < PMM_CHUNK_PAGES) ? total_pages - first : PMM_CHUNK_PAGES;
+}
+
+size_t pmm_chunk_free_pages(size_t chunk) {
+    return (chunk < total_chunks) ? chunk_free[chunk] : 0;
 }
 
 void* pmm_alloc(size_t size) {
-    // Align the size to a page boundary
-    size_t aligned_size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (size == 0) return NULL;
+    size_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    unsigned int order = pmm_order_for_pages(pages);
 
-    if (pmm_next_free + aligned_size > PMM_MAX) {
-        return NULL; // Out of memory
+    void* addr = pmm_alloc_pages(order);
+    if (addr == NULL) {
+        return NULL;
+    }
+    // Give the unused tail of the power-of-two block straight back.
+    size_t first = (uint64_t)addr / PAGE_SIZE;
+    if (pages < ((size_t)1 << order)) {
+        buddy_free_range(first + pages, ((size_t)1 << order) - pages);
     }
-
-    void* addr = (void*)pmm_next_free;
-    pmm_next_free += aligned_size;
     return addr;
-} 
\ No newline at end of file
+}
+
+/* Take [addr, addr+size) out of the free lists, splitting any buddy block that
+   straddles its edges. Fails without side effects if any page is in use. */
+bool pmm_claim(void* addr, size_t size) {
+    if (addr == NULL || size == 0 || (uint64_t)addr < 0x100000) return false;
+    size_t first = (uint64_t)addr / PAGE_SIZE;
+    size_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    size_t end = first + pages;
+    if (end > total_pages) return false;
+    for (size_t page = first; page < end; page++) {
+        if (bitmap_test(page)) return false;
+    }
+
+    size_t page = first;
+    while (page < end) {
+        // Find the free block holding this page; only block heads carry an order.
+        unsigned int order = 0;
+        size_t head = page;
+        while (buddy_order[head] != order) {
+            order++;
+            head = page & ~(((size_t)1 << order) - 1);
+        }
+        size_t block_end = head + ((size_t)1 << order);
+        buddy_remove((uint32_t)head, order);
+
+        // Hand back the parts of the block outside the claimed range.
+        for (size_t piece = head; piece < page; ) {
+            unsigned int o = buddy_fit_order(piece, page - piece);
+            buddy_push((uint32_t)piece, o);
+            piece += (size_t)1 << o;
+        }
+        for (size_t piece = end; piece < block_end; ) {
+            unsigned int o = buddy_fit_order(piece, block_end - piece);
+            buddy_push((uint32_t)piece, o);
+            piece += (size_t)1 << o;
+        }
+        page = block_end;
+    }
+
+    bitmap_set_range(first, pages);
+    return true;
+}
+
+void pmm_free(void* addr, size_t size) {
+    if (addr == NULL || size == 0 || (uint64_t)addr < 0x100000) return;
+    size_t first = (uint64_t)addr / PAGE_SIZE;
+    size_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (first + pages > total_pages) return;
+    buddy_free_range(first, pages);
+}
+
+/* Time PMM_BENCH_BATCH-sized rounds of single-page alloc/free and report over serial. */
+void pmm_benchmark(size_t iterations) {
+    void* pages[PMM_BENCH_BATCH];
+    uint64_t alloc_cycles = 0;
+    uint64_t free_cycles = 0;
+    size_t done = 0;
+    uint64_t tick_start = pit_get_ticks();
+
+    while (done < iterations) {
+        size_t batch = iterations - done;
+        if (batch > PMM_BENCH_BATCH) batch = PMM_BENCH_BATCH;
+
+        size_t got = 0;
+        uint64_t t0 = rdtsc();
+        while (got < batch && (pages[got] = pmm_alloc_page()) != NULL) {
+            got++;
+        }
+        uint64_t t1 = rdtsc();
+        for (size_t i = 0; i < got; i++) {
+            pmm_free_page(pages[i]);
+        }
+        uint64_t t2 = rdtsc();
+
+        alloc_cycles += t1 - t0;
+        free_cycles += t2 - t1;
+        done += got;
+        if (got < batch) {
+            serial_writestring("PMM bench: out of memory, stopping early\n");
+            break;
+        }
+    }
+
+    uint64_t ms = pit_get_ticks() - tick_start;
+    serial_writestring("PMM bench: ");
+    serial_writedec(done);
+    serial_writestring(" pages, alloc ");
+    serial_writedec(done ? alloc_cycles / done : 0);
+    serial_writestring(" cycles/page, free ");
+    serial_writedec(done ? free_cycles / done : 0);
+    serial_writestring(" cycles/page, ");
+    serial_writedec(ms);
+    serial_writestring(" ms\n");
+}
@@ -6,17 +6,71 @@
 #include "multiboot2.h"
 
 #define PAGE_SIZE 4096
+// Largest buddy block is 2^PMM_MAX_ORDER pages (16 MiB).
+#define PMM_MAX_ORDER 12
+
+// Free-page counters are also kept per 2 MiB chunk of physical memory.
+#define PMM_CHUNK_PAGES 512
+
+// Pre-zeroed single pages kept ready for page tables and kzalloc_pages().
+#define PMM_ZERO_POOL_PAGES 64
+#define PMM_ZERO_REFILL_BATCH 8
 
 typedef struct {
     size_t total_pages;
     size_t used_pages;
     size_t free_pages;
+    // Buddy free blocks per order, and the size of the largest one in pages
+    // (0 when nothing is free): the biggest block pmm_alloc_pages() can return.
+    size_t free_blocks[PMM_MAX_ORDER + 1];
+    size_t largest_free_block_pages;
+    // Longest run of contiguous free pages, however it is split into blocks;
+    // compare with largest_free_block_pages to see buddy fragmentation.
+    size_t longest_free_run_pages;
+    // 2 MiB chunks that are entirely free, entirely used, and in total.
+    size_t total_chunks;
+    size_t empty_chunks;
+    size_t full_chunks;
+    // Pages sitting in the zero pool (counted as used).
+    size_t zero_pool_pages;
 } pmm_info_t;
 
-bool pmm_init(struct multiboot2_tag_mmap *mmap_tag);
+// A physical byte range handed to pmm_init() that must never be allocated
+// (multiboot info, modules, framebuffer, ...). The kernel image is always reserved.
+typedef struct {
+    uint64_t base;
+    uint64_t length;
+} pmm_range_t;
+
+#define PMM_MAX_RESERVED 16
+
+// Addresses taken and returned below are physical; dereference them through
+// phys_to_virt() (mem.h). pmm_init() only releases RAM below 4 GiB (the boot
+// identity map); pmm_release_high_memory() adds the rest once the direct map covers it,
+// and from then on the PMM reaches its own metadata through the direct map too.
+bool pmm_init(struct multiboot2_tag_mmap *mmap_tag, const pmm_range_t* reserved, size_t reserved_count);
+void pmm_release_high_memory(void);
 void* pmm_alloc_page();
 void pmm_free_page(void* page);
+// Allocate/free a naturally aligned block of 2^order physically contiguous pages.
+void* pmm_alloc_pages(unsigned int order);
+void pmm_free_pages(void* addr, unsigned int order);
+// Allocate exactly enough contiguous pages for size bytes; release with pmm_free().
 void* pmm_alloc(size_t size);
+void pmm_free(void* addr, size_t size);
+// Zeroed single page, served from the pool when possible; free with pmm_free_page().
+void* pmm_alloc_zeroed_page(void);
+// Refill the zero pool a little; call from the idle loop.
+void pmm_zero_pool_refill(void);
+// Allocate the specific range [addr, addr+size) if every page in it is free.
+bool pmm_claim(void* addr, size_t size);
+// Snapshot of the counters. Only the longest free run needs work: chunks
+// changed since the last call are rescanned, then the chunks are combined.
 void pmm_get_info(pmm_info_t* info);
+// Free pages in 2 MiB chunk `chunk`, and that chunk's size in pages (the last may be short).
+size_t pmm_chunk_free_pages(size_t chunk);
+size_t pmm_chunk_pages(size_t chunk);
+// Allocate and free `iterations` single pages in batches, printing timings to serial.
+void pmm_benchmark(size_t iterations);
 
 #endif // PMM_H 
\ No newline at end of file
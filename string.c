@@ -1,53 +1,180 @@
 #include "string.h"
+#include "cpu.h"
+#include <stdbool.h>
 
-int strcmp(const char* s1, const char* s2) {
-    while (*s1 && (*s1 == *s2)) {
-        s1++;
-        s2++;
-    }
-    return *(unsigned char*)s1 - *(unsigned char*)s2;
+/*
+ * memcpy/memmove/memset
+ * - SSE2 is part of x86-64 and enabled by kernel_entry.asm, so it is the
+ *   baseline: a byte head up to a 16-byte aligned destination, 64 bytes per
+ *   loop iteration, then 16-byte steps and a byte tail. The loops are inline
+ *   asm so they stay tight whatever the optimisation level.
+ * - On CPUs with ERMS (enhanced rep movsb/stosb, CPUID.7.0:EBX[9]) larger
+ *   operations use rep movsb/stosb; with FSRM (fast short rep movsb,
+ *   CPUID.7.0:EDX[4]) memcpy uses rep movsb at every size.
+ * - The interrupt stubs save the SSE state, so these are safe in handlers.
+ */
+#define STRING_SSE_MIN 16      // below this, plain byte loops
+#define STRING_REP_MIN 512     // ERMS rep movsb/stosb from here on
+
+static bool has_erms = false;
+static bool has_fsrm = false;
+
+void string_init(void) {
+    uint32_t a, b, c, d;
+    cpuid(0, 0, &a, &b, &c, &d);
+    if (a < 7) return;
+    cpuid(7, 0, &a, &b, &c, &d);
+    has_erms = (b & (1u << 9)) != 0;
+    has_fsrm = (d & (1u << 4)) != 0;
 }
 
-int strncmp(const char* s1, const char* s2, size_t n) {
-    while (n && *s1 && (*s1 == *s2)) {
-        ++s1;
-        ++s2;
-        --n;
-    }
-    if (n == 0) {
-        return 0;
-    } else {
-        return (*(unsigned char*)s1 - *(unsigned char*)s2);
-    }
+const char* string_copy_strategy(void) {
+    if (has_fsrm) return "rep movsb (FSRM)";
+    if (has_erms) return "SSE2, rep movsb/stosb from 512 B (ERMS)";
+    return "SSE2";
 }
 
-void* memset(void* s, int c, size_t n) {
-    unsigned char* p = s;
-    while (n--) *p++ = (unsigned char)c;
-    return s;
+static inline void copy_bytes(uint8_t* d, const uint8_t* s, size_t n) {
+    while (n--) *d++ = *s++;
 }
 
-char* strcpy(char* dest, const char* src) {
-    char* original_dest = dest;
-    while ((*dest++ = *src++));
-    return original_dest;
+static inline void rep_movsb(void* d, const void* s, size_t n) {
+    asm volatile("rep movsb" : "+D"(d), "+S"(s), "+c"(n) : : "memory");
+}
+
+static inline void rep_stosb(void* d, int c, size_t n) {
+    asm volatile("rep stosb" : "+D"(d), "+c"(n) : "a"(c) : "memory");
+}
+
+/* Forward copy with SSE2. Each chunk is loaded before it is stored, so this
+   is also correct for memmove when dest is 16 or more bytes below src. */
+static void copy_sse2(uint8_t* d, const uint8_t* s, size_t n) {
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    if (head > n) head = n;
+    copy_bytes(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+
+    size_t blocks = n / 64;
+    size_t steps = (n % 64) / 16;
+    asm volatile(
+        "test %2, %2\n\t"
+        "jz 2f\n"
+        "1:\n\t"
+        "movdqu   (%1), %%xmm0\n\t"
+        "movdqu 16(%1), %%xmm1\n\t"
+        "movdqu 32(%1), %%xmm2\n\t"
+        "movdqu 48(%1), %%xmm3\n\t"
+        "movdqa %%xmm0,   (%0)\n\t"
+        "movdqa %%xmm1, 16(%0)\n\t"
+        "movdqa %%xmm2, 32(%0)\n\t"
+        "movdqa %%xmm3, 48(%0)\n\t"
+        "add $64, %1\n\t"
+        "add $64, %0\n\t"
+        "dec %2\n\t"
+        "jnz 1b\n"
+        "2:\n\t"
+        "test %3, %3\n\t"
+        "jz 4f\n"
+        "3:\n\t"
+        "movdqu (%1), %%xmm0\n\t"
+        "movdqa %%xmm0, (%0)\n\t"
+        "add $16, %1\n\t"
+        "add $16, %0\n\t"
+        "dec %3\n\t"
+        "jnz 3b\n"
+        "4:"
+        : "+r"(d), "+r"(s), "+r"(blocks), "+r"(steps)
+        :
+        : "xmm0", "xmm1", "xmm2", "xmm3", "cc", "memory");
+    copy_bytes(d, s, n % 16);
+}
+
+/* Backward copy with SSE2 for memmove when dest is 16 or more bytes above src. */
+static void copy_sse2_backward(uint8_t* d, const uint8_t* s, size_t n) {
+    d += n;
+    s += n;
+    size_t tail = (uintptr_t)d & 15;
+    if (tail > n) tail = n;
+    n -= tail;
+    while (tail--) *--d = *--s;
+
+    size_t steps = n / 16;
+    asm volatile(
+        "test %2, %2\n\t"
+        "jz 2f\n"
+        "1:\n\t"
+        "sub $16, %1\n\t"
+        "sub $16, %0\n\t"
+        "movdqu (%1), %%xmm0\n\t"
+        "movdqa %%xmm0, (%0)\n\t"
+        "dec %2\n\t"
+        "jnz 1b\n"
+        "2:"
+        : "+r"(d), "+r"(s), "+r"(steps)
+        :
+        : "xmm0", "cc", "memory");
+    n %= 16;
+    while (n--) *--d = *--s;
+}
+
+/* Store an 8-byte pattern over [d, d+n); d 16-byte aligned, n a multiple of 16. */
+static void fill_sse2_aligned(uint8_t* d, uint64_t pattern, size_t n) {
+    size_t blocks = n / 64;
+    size_t steps = (n % 64) / 16;
+    asm volatile(
+        "movq %3, %%xmm0\n\t"
+        "punpcklqdq %%xmm0, %%xmm0\n\t"
+        "test %1, %1\n\t"
+        "jz 2f\n"
+        "1:\n\t"
+        "movdqa %%xmm0,   (%0)\n\t"
+        "movdqa %%xmm0, 16(%0)\n\t"
+        "movdqa %%xmm0, 32(%0)\n\t"
+        "movdqa %%xmm0, 48(%0)\n\t"
+        "add $64, %0\n\t"
+        "dec %1\n\t"
+        "jnz 1b\n"
+        "2:\n\t"
+        "test %2, %2\n\t"
+        "jz 4f\n"
+        "3:\n\t"
+        "movdqa %%xmm0, (%0)\n\t"
+        "add $16, %0\n\t"
+        "dec %2\n\t"
+        "jnz 3b\n"
+        "4:"
+        : "+r"(d), "+r"(blocks), "+r"(steps)
+        : "r"(pattern)
+        : "xmm0", "cc", "memory");
 }
 
 void* memcpy(void* dest, const void* src, size_t n) {
-    unsigned char* d = dest;
-    const unsigned char* s = src;
-    while (n--) *d++ = *s++;
+    if (has_fsrm || (has_erms && n >= STRING_REP_MIN)) {
+        rep_movsb(dest, src, n);
+    } else if (n < STRING_SSE_MIN) {
+        copy_bytes(dest, src, n);
+    } else {
+        copy_sse2(dest, src, n);
+    }
     return dest;
 }
 
 void* memmove(void* dest, const void* src, size_t n) {
     if (dest == src || n == 0) return dest;
 
-    unsigned char* d = (unsigned char*)dest;
-    const unsigned char* s = (const unsigned char*)src;
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
 
     if (d < s) {
+        // Forward: rep movsb and copy_sse2 both cope once src is 16 bytes ahead.
+        if ((size_t)(s - d) >= STRING_SSE_MIN) return memcpy(dest, src, n);
         while (n--) *d++ = *s++;
+    } else if ((size_t)(d - s) >= n) {
+        return memcpy(dest, src, n);
+    } else if ((size_t)(d - s) >= STRING_SSE_MIN) {
+        copy_sse2_backward(d, s, n);
     } else {
         d += n;
         s += n;
@@ -56,23 +183,144 @@ void* memmove(void* dest, const void* src, size_t n) {
     return dest;
 }
 
-size_t strlen(const char* s) {
-    size_t len = 0;
-    while (*s++) len++;
-    return len;
+void* memset(void* s, int c, size_t n) {
+    uint8_t* p = s;
+    if (has_erms && n >= STRING_REP_MIN) {
+        rep_stosb(p, c, n);
+        return s;
+    }
+    if (n < STRING_SSE_MIN) {
+        while (n--) *p++ = (uint8_t)c;
+        return s;
+    }
+    while ((uintptr_t)p & 15) {
+        *p++ = (uint8_t)c;
+        n--;
+    }
+    fill_sse2_aligned(p, (uint8_t)c * 0x0101010101010101ULL, n & ~(size_t)15);
+    p += n & ~(size_t)15;
+    n &= 15;
+    while (n--) *p++ = (uint8_t)c;
+    return s;
 }
 
-char* strchr(const char* s, int c) {
-    while (*s != '\0') {
-        if (*s == c) {
-            return (char*)s;
+void* memset32(void* s, uint32_t value, size_t count) {
+    uint32_t* p = s;
+    if (((uintptr_t)p & 3) || count < STRING_SSE_MIN / 2) {
+        while (count--) *p++ = value;
+        return s;
+    }
+    while ((uintptr_t)p & 15) {
+        *p++ = value;
+        count--;
+    }
+    size_t bulk = count & ~(size_t)3;
+    fill_sse2_aligned((uint8_t*)p, ((uint64_t)value << 32) | value, bulk * 4);
+    p += bulk;
+    count -= bulk;
+    while (count--) *p++ = value;
+    return s;
+}
+
+/*
+ * strlen/strcmp/strchr/memcmp work a 64-bit word at a time. A word has a
+ * zero byte iff (v - ONES) & ~v & HIGHS is non-zero, and the lowest set bit
+ * marks the first one exactly (little-endian). String scans read aligned
+ * words only, which never cross into a page the string does not reach.
+ * Bytes of the first word that precede the string are forced to 0xFF. The
+ * unaligned side of strcmp falls back to bytes where a word would cross a
+ * page.
+ */
+#define WORD_ONES 0x0101010101010101ULL
+#define WORD_HIGHS 0x8080808080808080ULL
+#define STRING_PAGE_SIZE 4096
+
+typedef uint64_t __attribute__((may_alias)) word_t;
+typedef uint64_t __attribute__((may_alias, aligned(1))) unaligned_word_t;
+
+static inline uint64_t word_has_zero(uint64_t v) {
+    return (v - WORD_ONES) & ~v & WORD_HIGHS;
+}
+
+static inline size_t word_first_byte(uint64_t mask) {
+    return (size_t)__builtin_ctzll(mask) / 8;
+}
+
+/* Aligned word containing p, with the bytes before p set to 0xFF. */
+static inline uint64_t word_at(const char* p, const word_t** w) {
+    *w = (const word_t*)((uintptr_t)p & ~(uintptr_t)7);
+    uint64_t before = ((uintptr_t)p & 7) ? (1ULL << (((uintptr_t)p & 7) * 8)) - 1 : 0;
+    return **w | before;
+}
+
+int strcmp(const char* s1, const char* s2) {
+    const unsigned char* a = (const unsigned char*)s1;
+    const unsigned char* b = (const unsigned char*)s2;
+    while ((uintptr_t)a & 7) {
+        if (*a != *b || *a == 0) return *a - *b;
+        a++;
+        b++;
+    }
+    for (;;) {
+        if (((uintptr_t)b & (STRING_PAGE_SIZE - 1)) > STRING_PAGE_SIZE - 8) {
+            // A word load from b would reach into the next page.
+            for (int i = 0; i < 8; i++, a++, b++) {
+                if (*a != *b || *a == 0) return *a - *b;
+            }
+            continue;
         }
-        s++;
+        uint64_t x = *(const word_t*)a;
+        uint64_t y = *(const unaligned_word_t*)b;
+        if (x != y || word_has_zero(x)) break;
+        a += 8;
+        b += 8;
+    }
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a - *b;
+}
+
+int strncmp(const char* s1, const char* s2, size_t n) {
+    while (n && *s1 && (*s1 == *s2)) {
+        ++s1;
+        ++s2;
+        --n;
     }
-    if (c == '\0') {
-        return (char*)s;
+    if (n == 0) {
+        return 0;
+    } else {
+        return (*(unsigned char*)s1 - *(unsigned char*)s2);
     }
-    return NULL;
+}
+
+char* strcpy(char* dest, const char* src) {
+    char* original_dest = dest;
+    while ((*dest++ = *src++));
+    return original_dest;
+}
+
+size_t strlen(const char* s) {
+    const word_t* w;
+    uint64_t zero = word_has_zero(word_at(s, &w));
+    while (!zero) zero = word_has_zero(*++w);
+    return (size_t)((const char*)w + word_first_byte(zero) - s);
+}
+
+char* strchr(const char* s, int c) {
+    uint64_t pattern = (uint8_t)c * WORD_ONES;
+    const word_t* w = (const word_t*)((uintptr_t)s & ~(uintptr_t)7);
+    uint64_t before = ((uintptr_t)s & 7) ? (1ULL << (((uintptr_t)s & 7) * 8)) - 1 : 0;
+    uint64_t v = *w;
+    // Bytes before s must match neither the terminator nor c.
+    uint64_t hit = word_has_zero(v | before) | word_has_zero((v ^ pattern) | before);
+    while (!hit) {
+        v = *++w;
+        hit = word_has_zero(v) | word_has_zero(v ^ pattern);
+    }
+    const char* p = (const char*)w + word_first_byte(hit);
+    return *p == (char)c ? (char*)p : NULL;
 }
 
 char* strrchr(const char* s, int c) {
@@ -95,6 +343,17 @@ char* strcat(char* dest, const char* src) {
 int memcmp(const void* s1, const void* s2, size_t n) {
     const unsigned char* p1 = (const unsigned char*)s1;
     const unsigned char* p2 = (const unsigned char*)s2;
+    // Both ranges are fully readable, so unaligned words are fine here.
+    while (n >= 8) {
+        uint64_t diff = *(const unaligned_word_t*)p1 ^ *(const unaligned_word_t*)p2;
+        if (diff) {
+            size_t i = word_first_byte(diff);
+            return p1[i] - p2[i];
+        }
+        p1 += 8;
+        p2 += 8;
+        n -= 8;
+    }
     while (n--) {
         if (*p1 != *p2) {
             return *p1 - *p2;
@@ -103,4 +362,86 @@ int memcmp(const void* s1, const void* s2, size_t n) {
         p2++;
     }
     return 0;
-}
\ No newline at end of file
+}
+
+/* Byte-at-a-time references for string_selftest(). */
+static int ref_strcmp(const char* s1, const char* s2) {
+    while (*s1 && (*s1 == *s2)) {
+        s1++;
+        s2++;
+    }
+    return *(unsigned char*)s1 - *(unsigned char*)s2;
+}
+
+static size_t ref_strlen(const char* s) {
+    size_t len = 0;
+    while (*s++) len++;
+    return len;
+}
+
+static const char* ref_strchr(const char* s, int c) {
+    for (;; s++) {
+        if (*s == (char)c) return s;
+        if (*s == '\0') return NULL;
+    }
+}
+
+static int ref_memcmp(const void* s1, const void* s2, size_t n) {
+    const unsigned char* p1 = (const unsigned char*)s1;
+    const unsigned char* p2 = (const unsigned char*)s2;
+    for (; n--; p1++, p2++) {
+        if (*p1 != *p2) return *p1 - *p2;
+    }
+    return 0;
+}
+
+static uint32_t selftest_rand(uint32_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+size_t string_selftest(uint8_t* buf, size_t size, unsigned iterations) {
+    // Few distinct byte values so strings share prefixes and hit 0x80/0xFF edges.
+    static const uint8_t alphabet[] = { 'a', 'b', 0x01, 0x7F, 0x80, 0xFF };
+    uint32_t rng = 0x2545F491u;
+    size_t failures = 0;
+    if (size < 256) return 1;
+
+    for (unsigned it = 0; it < iterations; it++) {
+        // Half of the pairs start out equal so strcmp runs to the end.
+        bool equal = selftest_rand(&rng) & 1;
+        size_t len = selftest_rand(&rng) % 128;
+        size_t len2 = equal ? len : selftest_rand(&rng) % 128;
+        // One string ends on the last byte of buf, the other sits at a
+        // random offset in the first half; they swap roles every iteration.
+        char* low = (char*)buf + selftest_rand(&rng) % (size / 2 - 128);
+        char* s1 = (it & 1) ? (char*)buf + size - len - 1 : low;
+        char* s2 = (it & 1) ? low : (char*)buf + size - len2 - 1;
+
+        for (size_t i = 0; i < len; i++) s1[i] = (char)alphabet[selftest_rand(&rng) % sizeof(alphabet)];
+        s1[len] = '\0';
+        if (equal) {
+            for (size_t i = 0; i <= len; i++) s2[i] = s1[i];
+            // Then maybe change or cut one byte.
+            if (len && (selftest_rand(&rng) & 1)) {
+                uint32_t r = selftest_rand(&rng);
+                s2[r % len] = (r & 0x100) ? '\0' : (char)alphabet[(r >> 9) % sizeof(alphabet)];
+            }
+        } else {
+            for (size_t i = 0; i < len2; i++) s2[i] = (char)alphabet[selftest_rand(&rng) % sizeof(alphabet)];
+            s2[len2] = '\0';
+        }
+        int c = alphabet[selftest_rand(&rng) % sizeof(alphabet)];
+        if ((selftest_rand(&rng) & 7) == 0) c = 0;
+        size_t n = selftest_rand(&rng) % ((len < len2 ? len : len2) + 1);
+
+        if (strlen(s1) != ref_strlen(s1)) failures++;
+        if (strcmp(s1, s2) != ref_strcmp(s1, s2)) failures++;
+        if (strcmp(s2, s1) != ref_strcmp(s2, s1)) failures++;
+        if (strchr(s1, c) != ref_strchr(s1, c)) failures++;
+        if (memcmp(s1, s2, n) != ref_memcmp(s1, s2, n)) failures++;
+    }
+    return failures;
+}
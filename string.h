@@ -2,6 +2,13 @@
 #define STRING_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+// Pick the memcpy/memmove/memset strategy for this CPU (rep movsb/stosb on
+// ERMS/FSRM parts). Until it runs, the SSE2 paths are used.
+void string_init(void);
+// Short description of the copy strategy in use.
+const char* string_copy_strategy(void);
 
 int strcmp(const char* s1, const char* s2);
 int strncmp(const char* s1, const char* s2, size_t n);
@@ -9,10 +16,16 @@ char* strcpy(char* dest, const char* src);
 void* memcpy(void* dest, const void* src, size_t n);
 void* memmove(void* dest, const void* src, size_t n);
 void* memset(void* s, int c, size_t n);
+// Fill count 32-bit words with value, e.g. a span of 32-bpp pixels.
+void* memset32(void* s, uint32_t value, size_t count);
 int memcmp(const void* s1, const void* s2, size_t n);
 size_t strlen(const char* s);
 char* strchr(const char* s, int c);
 char* strrchr(const char* s, int c);
 char* strcat(char* dest, const char* src);
+// Check strlen/strcmp/strchr/memcmp against byte-loop references on random
+// strings in buf[0, size), many ending on its last byte; returns mismatches.
+// Placing buf right before an unmapped page also catches over-reads.
+size_t string_selftest(uint8_t* buf, size_t size, unsigned iterations);
 
 #endif
\ No newline at end of file
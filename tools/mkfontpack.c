@@ -0,0 +1,144 @@
+/* mkfontpack.c – Host tool: pre-rasterise SpringIntoView's embedded font
+ *
+ * Writes C source for the tables declared in SpringIntoView/font_pack.h to
+ * stdout. It links the kernel's own stb_truetype configuration so the packed
+ * bitmaps and metrics are bit-identical to what SIV would rasterise at
+ * runtime.
+ *
+ *   cc -O2 tools/mkfontpack.c -o tools/mkfontpack -lm
+ *   ./tools/mkfontpack > SpringIntoView/font_pack.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+// The kernel heap API, backed by libc for stb_truetype_impl.c.
+void* kmalloc(size_t size) { return malloc(size); }
+void kfree(void* ptr) { free(ptr); }
+void* krealloc(void* ptr, size_t size) { return realloc(ptr, size); }
+
+// Build machines need not be x86-64; take sqrt from libm instead of sqrtsd.
+#define STBTT_HOST
+#include "../SpringIntoView/stb_truetype_impl.c"
+#include "../SpringIntoView/font.h"
+#include "../SpringIntoView/font_pack.h"
+
+// Scales the kernel draws text at.
+static const float pack_scales[] = { 1.0f, 1.5f, 2.0f };
+#define PACK_SCALES (sizeof(pack_scales) / sizeof(pack_scales[0]))
+
+// ASCII and box drawing; block elements (U+2580..) are synthesised by SIV.
+static const struct { int first, last; } pack_ranges[] = {
+    { 0x20, 0x7E },
+    { 0x2500, 0x257F },
+};
+#define PACK_RANGES (sizeof(pack_ranges) / sizeof(pack_ranges[0]))
+
+#define MAX_GLYPHS 1024
+#define MAX_KERNS 65536
+
+static siv_pack_glyph_t glyphs[MAX_GLYPHS];
+static siv_pack_kern_t kerns[MAX_KERNS];
+static siv_pack_scale_t scales[PACK_SCALES];
+static unsigned char* bitmaps;
+static size_t bitmaps_size, bitmaps_cap;
+static unsigned glyph_count, kern_count;
+
+static void fail(const char* msg) {
+    fprintf(stderr, "mkfontpack: %s\n", msg);
+    exit(1);
+}
+
+static uint32_t add_bitmap(size_t bytes) {
+    if (bitmaps_size + bytes > bitmaps_cap) {
+        bitmaps_cap = (bitmaps_size + bytes) * 2;
+        bitmaps = realloc(bitmaps, bitmaps_cap);
+        if (!bitmaps) fail("out of memory");
+    }
+    uint32_t offset = (uint32_t)bitmaps_size;
+    bitmaps_size += bytes;
+    return offset;
+}
+
+int main(void) {
+    stbtt_fontinfo font;
+    if (!stbtt_InitFont(&font, RobotoMono_Regular_ttf, stbtt_GetFontOffsetForIndex(RobotoMono_Regular_ttf, 0)))
+        fail("cannot parse the embedded font");
+
+    int ascent, descent, line_gap;
+    stbtt_GetFontVMetrics(&font, &ascent, &descent, &line_gap);
+
+    for (size_t si = 0; si < PACK_SCALES; si++) {
+        float font_scale = stbtt_ScaleForPixelHeight(&font, 16.0f * pack_scales[si]);
+        siv_pack_scale_t* ps = &scales[si];
+        ps->scale = pack_scales[si];
+        ps->ascent = (int16_t)(int)(ascent * font_scale);
+        ps->height = (int16_t)(int)((ascent - descent) * font_scale);
+        ps->first_glyph = glyph_count;
+        ps->first_kern = kern_count;
+
+        for (size_t r = 0; r < PACK_RANGES; r++) {
+            for (int cp = pack_ranges[r].first; cp <= pack_ranges[r].last; cp++) {
+                if (stbtt_FindGlyphIndex(&font, cp) == 0) continue;
+                if (glyph_count == MAX_GLYPHS) fail("too many glyphs");
+                int ix0, iy0, ix1, iy1, adv, lsb;
+                stbtt_GetCodepointBitmapBox(&font, cp, font_scale, font_scale, &ix0, &iy0, &ix1, &iy1);
+                stbtt_GetCodepointHMetrics(&font, cp, &adv, &lsb);
+                int w = ix1 - ix0, h = iy1 - iy0;
+                if (w < 0 || h < 0) w = h = 0;
+                if (w > 255 || h > 255) fail("glyph too large for the pack format");
+
+                siv_pack_glyph_t* g = &glyphs[glyph_count++];
+                g->codepoint = (uint16_t)cp;
+                g->w = (uint8_t)w;
+                g->h = (uint8_t)h;
+                g->x_off = (int16_t)ix0;
+                g->y_off = (int16_t)(ps->ascent + iy0);
+                g->advance = (int16_t)(int)(adv * font_scale);
+                g->bitmap = add_bitmap((size_t)w * h);
+                if (w > 0 && h > 0)
+                    stbtt_MakeCodepointBitmap(&font, bitmaps + g->bitmap, w, h, w, font_scale, font_scale, cp);
+            }
+        }
+        ps->glyph_count = glyph_count - ps->first_glyph;
+
+        for (uint32_t a = ps->first_glyph; a < glyph_count; a++) {
+            for (uint32_t b = ps->first_glyph; b < glyph_count; b++) {
+                int adjust = (int)(stbtt_GetCodepointKernAdvance(&font, glyphs[a].codepoint, glyphs[b].codepoint) * font_scale);
+                if (adjust == 0) continue;
+                if (kern_count == MAX_KERNS) fail("too many kerning pairs");
+                kerns[kern_count++] = (siv_pack_kern_t){ glyphs[a].codepoint, glyphs[b].codepoint, (int16_t)adjust };
+            }
+        }
+        ps->kern_count = kern_count - ps->first_kern;
+    }
+
+    printf("/* Generated by tools/mkfontpack from SpringIntoView/font.h. Do not edit. */\n");
+    printf("#include \"font_pack.h\"\n\n");
+    printf("const uint32_t siv_font_pack_scale_count = %zu;\n\n", PACK_SCALES);
+    printf("const siv_pack_scale_t siv_font_pack_scales[] = {\n");
+    for (size_t i = 0; i < PACK_SCALES; i++) {
+        const siv_pack_scale_t* s = &scales[i];
+        printf("    { %.9ef, %d, %d, %u, %u, %u, %u },\n", s->scale, s->ascent, s->height,
+               s->first_glyph, s->glyph_count, s->first_kern, s->kern_count);
+    }
+    printf("};\n\nconst siv_pack_glyph_t siv_font_pack_glyphs[] = {\n");
+    for (unsigned i = 0; i < glyph_count; i++) {
+        const siv_pack_glyph_t* g = &glyphs[i];
+        printf("    { 0x%04X, %u, %u, %d, %d, %d, %u },\n", g->codepoint, g->w, g->h,
+               g->x_off, g->y_off, g->advance, g->bitmap);
+    }
+    // Keep the array non-empty when the font has no kerning.
+    printf("};\n\nconst siv_pack_kern_t siv_font_pack_kerns[] = {\n");
+    for (unsigned i = 0; i < kern_count; i++)
+        printf("    { 0x%04X, 0x%04X, %d },\n", kerns[i].left, kerns[i].right, kerns[i].adjust);
+    if (kern_count == 0) printf("    { 0, 0, 0 },\n");
+    printf("};\n\nconst uint8_t siv_font_pack_bitmaps[] = {");
+    for (size_t i = 0; i < bitmaps_size; i++)
+        printf("%s0x%02x,", (i % 16) ? " " : "\n    ", bitmaps[i]);
+    if (bitmaps_size == 0) printf("\n    0x00,");
+    printf("\n};\n");
+
+    fprintf(stderr, "mkfontpack: %u glyphs, %u kerning pairs, %zu bitmap bytes\n",
+            glyph_count, kern_count, bitmaps_size);
+    return 0;
+}
@@ -0,0 +1,111 @@
+/* vmalloc.c – Demand-paged kernel virtual memory areas
+ *
+ * Areas are carved first-fit out of [VMALLOC_BASE, VMALLOC_BASE + VMALLOC_SIZE)
+ * and kept in a small table sorted by address, each followed by an unmapped
+ * guard page. vmalloc() only reserves addresses; the first access to a page
+ * faults and vmalloc_handle_fault() maps a zeroed PMM page there, so a big
+ * buffer only costs physical memory for the pages actually used.
+ */
+#include "vmalloc.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "serial.h"
+
+#define PF_PROTECTION 0x1   // page fault error code: page was present
+
+typedef struct {
+    uint64_t start;
+    uint64_t pages;       // usable pages, excluding the guard page
+    uint64_t committed;   // pages currently backed
+} vm_area_t;
+
+static vm_area_t areas[VMALLOC_MAX_AREAS];
+static size_t area_count = 0;
+static size_t fault_count = 0;
+
+/* Binary search for the area whose usable pages contain addr. */
+static vm_area_t* find_area(uint64_t addr) {
+    size_t lo = 0, hi = area_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        vm_area_t* a = &areas[mid];
+        if (addr < a->start) hi = mid;
+        else if (addr >= a->start + a->pages * PAGE_SIZE) lo = mid + 1;
+        else return a;
+    }
+    return NULL;
+}
+
+void* vmalloc(size_t size) {
+    if (size == 0 || area_count == VMALLOC_MAX_AREAS) return NULL;
+
+    uint64_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint64_t span = (pages + 1) * PAGE_SIZE;
+    uint64_t start = VMALLOC_BASE;
+    size_t i = 0;
+    for (; i < area_count; i++) {
+        if (areas[i].start - start >= span) break;
+        start = areas[i].start + (areas[i].pages + 1) * PAGE_SIZE;
+    }
+    if (i == area_count && VMALLOC_BASE + VMALLOC_SIZE - start < span) {
+        serial_writestring("[Serial] vmalloc: address window exhausted.\n");
+        return NULL;
+    }
+
+    for (size_t j = area_count; j > i; j--) areas[j] = areas[j - 1];
+    areas[i] = (vm_area_t){ start, pages, 0 };
+    area_count++;
+    return (void*)start;
+}
+
+void vfree(void* ptr) {
+    if (ptr == NULL) return;
+
+    vm_area_t* a = find_area((uint64_t)ptr);
+    if (a == NULL || a->start != (uint64_t)ptr) {
+        serial_writestring("[Serial] vfree: bad pointer ");
+        serial_writehex((uint64_t)ptr);
+        serial_writestring("\n");
+        return;
+    }
+
+    // Only touched pages are mapped; the walk skips the holes in between.
+    vmm_unmap_free_range(a->start, a->pages * PAGE_SIZE);
+
+    size_t i = (size_t)(a - areas);
+    for (; i + 1 < area_count; i++) areas[i] = areas[i + 1];
+    area_count--;
+}
+
+/* Back the page at addr if it lies in a live area and was never touched.
+   Protection faults and the guard pages are left to the caller. */
+bool vmalloc_handle_fault(uint64_t addr, uint64_t err_code) {
+    if (err_code & PF_PROTECTION) return false;
+    vm_area_t* a = find_area(addr);
+    if (a == NULL) return false;
+
+    void* page = pmm_alloc_zeroed_page();
+    if (page == NULL) {
+        serial_writestring("[Serial] vmalloc: out of memory on demand fault.\n");
+        return false;
+    }
+    if (!vmm_map_page(addr & ~(uint64_t)(PAGE_SIZE - 1), (uint64_t)page, PAGE_PRESENT | PAGE_WRITABLE)) {
+        pmm_free_page(page);
+        return false;
+    }
+    a->committed++;
+    fault_count++;
+    return true;
+}
+
+void vmalloc_get_info(vmalloc_info_t* info) {
+    if (!info) return;
+    info->areas = area_count;
+    info->reserved_bytes = 0;
+    info->committed_bytes = 0;
+    for (size_t i = 0; i < area_count; i++) {
+        info->reserved_bytes += areas[i].pages * PAGE_SIZE;
+        info->committed_bytes += areas[i].committed * PAGE_SIZE;
+    }
+    info->faults = fault_count;
+}
@@ -0,0 +1,30 @@
+#ifndef VMALLOC_H
+#define VMALLOC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Kernel virtual window for vmalloc() areas: PML4 slot 384, 1 TiB.
+#define VMALLOC_BASE 0xFFFFC00000000000ULL
+#define VMALLOC_SIZE 0x10000000000ULL
+#define VMALLOC_MAX_AREAS 64
+
+typedef struct {
+    size_t areas;
+    size_t reserved_bytes;   // virtual space handed out
+    size_t committed_bytes;  // of which backed by physical pages
+    size_t faults;           // pages installed on demand since boot
+} vmalloc_info_t;
+
+// Reserve size bytes of page-aligned kernel virtual memory. Nothing is backed
+// up front: each page gets a zeroed PMM page on first touch. Returns NULL when
+// the window or the area table is full.
+void* vmalloc(size_t size);
+// Release an area and every physical page it committed.
+void vfree(void* ptr);
+// Called from the page fault handler; true if the fault was served.
+bool vmalloc_handle_fault(uint64_t addr, uint64_t err_code);
+void vmalloc_get_info(vmalloc_info_t* info);
+
+#endif // VMALLOC_H
@@ -4,19 +4,33 @@
 #include "serial.h"
 #include "string.h" // For memset
 #include "mem.h"
+#include "cpu.h"
 
 #define PAGE_SIZE 4096
 #define PAGING_FLAG_MASK 0xFFF
 #define ADDRESS_MASK (~PAGING_FLAG_MASK)
 #define PAGE_HUGE (1 << 7)
+#define PTE_PAT (1ULL << 7)                 // PAT bit in a 4KB PTE...
+#define PDE_PAT (1ULL << 12)                // ...and in a 2MB PDE
+#define PAGE_ACCESSED_DIRTY 0x60ULL         // set by the CPU, ignored when comparing entries
+#define HUGE_PAGE_SIZE 0x200000ULL
+#define PDT_SPAN 0x40000000ULL             // 1GB covered by one page directory
+#define VMM_INVLPG_MAX_PAGES 32            // above this, one CR3 reload beats per-page invlpg
+#define HUGE_ADDRESS_MASK 0x000FFFFFFFE00000ULL
+#define MSR_PAT 0x277
+// PAT entries 0-7: WB, WC, UC-, UC, WB, WT, UC-, UC. Only entry 1 differs from
+// the power-on default (WT), so PWT-only mappings become write-combining.
+#define PAT_VALUE 0x0007040600070106ULL
+#define PTE_ATTR_MASK (PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER | PAGE_WRITE_THROUGH | PAGE_CACHE_DISABLE | PTE_PAT)
+
+static bool pat_enabled = false;
+uint64_t phys_map_size = 0;
 
 /* Read CR3 (physical address of PML4) and return it as a pointer. */
 static uint64_t* get_pml4() {
     uint64_t cr3;
     asm volatile("mov %%cr3, %0" : "=r"(cr3));
-    // The address in CR3 is physical. With identity mapping for low memory,
-    // we can cast it directly to a pointer.
-    return (uint64_t*)(cr3);
+    return (uint64_t*)phys_to_virt(cr3 & ADDRESS_MASK);
 }
 
 /* Invalidate a single TLB entry for the given virtual address. */
@@ -24,103 +38,388 @@ static inline void invlpg(void* addr) {
     asm volatile("invlpg (%0)" : : "b"(addr) : "memory");
 }
 
+/* Reload CR3, dropping every non-global TLB entry. */
+static inline void flush_tlb_all(void) {
+    uint64_t cr3;
+    asm volatile("mov %%cr3, %0; mov %0, %%cr3" : "=r"(cr3) : : "memory");
+}
+
+/* Convert 4KB PTE flags to the equivalent 2MB PDE flags and back; only the
+   PAT bit moves (bit 7 in a PTE is PAGE_HUGE in a PDE). */
+static inline uint64_t pte_flags_to_pde(uint64_t flags) {
+    return (flags & ~PTE_PAT) | ((flags & PTE_PAT) ? PDE_PAT : 0) | PAGE_HUGE;
+}
+
+static inline uint64_t pde_flags_to_pte(uint64_t pde) {
+    uint64_t flags = pde & (PAGING_FLAG_MASK & ~(uint64_t)PAGE_HUGE);
+    return flags | ((pde & PDE_PAT) ? PTE_PAT : 0) | (pde & (1ULL << 63));
+}
+
 /* Walk to the next paging level, optionally allocating a new table. */
 static uint64_t* get_next_level_table(uint64_t* table, uint16_t index, bool allocate) {
     uint64_t entry = table[index];
     if (entry & PAGE_PRESENT) {
         // The address in the page table entry is physical.
-        // We can access it because the page tables are in identity-mapped low memory.
-        return (uint64_t*)(entry & ADDRESS_MASK);
+        return (uint64_t*)phys_to_virt(entry & ADDRESS_MASK);
     }
 
     if (!allocate) {
         return NULL;
     }
 
-    void* new_table_phys = pmm_alloc_page();
+    // Comes pre-zeroed from the PMM pool, so no memset on this path.
+    void* new_table_phys = pmm_alloc_zeroed_page();
     if (!new_table_phys) {
         serial_writestring("VMM: Failed to allocate page for new page table.\n");
         return NULL;
     }
-    
-    // The new table is in identity-mapped low memory.
-    memset(new_table_phys, 0, PAGE_SIZE);
+
     table[index] = (uint64_t)new_table_phys | PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
-    return (uint64_t*)new_table_phys;
+    return (uint64_t*)phys_to_virt((uint64_t)new_table_phys);
 }
 
-/* Map one 4KB page at virt_addr -> phys_addr with flags. */
-bool vmm_map_page(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags) {
+/* Walk to the page directory covering virt_addr, optionally allocating. */
+static uint64_t* get_pdt(uint64_t virt_addr, bool allocate) {
     uint64_t* pml4 = get_pml4();
     uint16_t pml4_index = (virt_addr >> 39) & 0x1FF;
     uint16_t pdpt_index = (virt_addr >> 30) & 0x1FF;
-    uint16_t pdt_index = (virt_addr >> 21) & 0x1FF;
-    uint16_t pt_index = (virt_addr >> 12) & 0x1FF;
 
-    uint64_t* pdpt = get_next_level_table(pml4, pml4_index, true);
-    if (!pdpt) return false;
+    uint64_t* pdpt = get_next_level_table(pml4, pml4_index, allocate);
+    if (!pdpt) return NULL;
+    // A 1GB page (only the direct map uses them) has no page directory.
+    if (pdpt[pdpt_index] & PAGE_HUGE) return NULL;
+    return get_next_level_table(pdpt, pdpt_index, allocate);
+}
+
+/* Replace the 2MB page in pdt[index] with a page table of 512 4KB entries
+   covering the same memory with the same flags. Returns the new table. */
+static uint64_t* split_huge_entry(uint64_t* pdt, uint16_t index, uint64_t virt_addr) {
+    uint64_t pde = pdt[index];
+    void* pt_phys = pmm_alloc_zeroed_page();
+    if (!pt_phys) {
+        serial_writestring("VMM: Failed to allocate page table for huge page split.\n");
+        return NULL;
+    }
 
-    uint64_t* pdt = get_next_level_table(pdpt, pdpt_index, true);
+    uint64_t* pt = (uint64_t*)phys_to_virt((uint64_t)pt_phys);
+    uint64_t base = pde & HUGE_ADDRESS_MASK;
+    uint64_t flags = pde_flags_to_pte(pde);
+    for (int i = 0; i < 512; i++) {
+        pt[i] = (base + (uint64_t)i * PAGE_SIZE) | flags;
+    }
+
+    pdt[index] = (uint64_t)pt_phys | PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
+    invlpg((void*)(virt_addr & ~(HUGE_PAGE_SIZE - 1)));
+    return pt;
+}
+
+/* Split the 2MB page covering virt_addr into 4KB pages, keeping its flags.
+   Succeeds trivially if the address is already mapped with 4KB pages. */
+bool vmm_split_huge_page(uint64_t virt_addr) {
+    uint64_t* pdt = get_pdt(virt_addr, false);
     if (!pdt) return false;
-    
-    if (pdt[pdt_index] & PAGE_HUGE) {
-        // If a 2MB huge page already maps this region and the caller requests
-        // an identity mapping for an address covered by that huge page, treat
-        // it as success (no-op). This avoids splitting the huge page.
-        uint64_t huge_base = pdt[pdt_index] & ADDRESS_MASK;
-        uint64_t virt_huge_base = virt_addr & ~0x1FFFFFULL; // 2MB aligned
-        if (virt_addr == phys_addr && virt_huge_base == huge_base) {
-            // Already mapped by an existing 2MB page; nothing to do.
-            return true;
+    uint16_t pdt_index = (virt_addr >> 21) & 0x1FF;
+    if (!(pdt[pdt_index] & PAGE_PRESENT)) return false;
+    if (!(pdt[pdt_index] & PAGE_HUGE)) return true;
+    return split_huge_entry(pdt, pdt_index, virt_addr) != NULL;
+}
+
+/* Batches TLB maintenance for one range operation: small ranges invalidate
+   each replaced entry with invlpg, larger ones reload CR3 once at the end. */
+typedef struct {
+    bool per_page;
+    bool flush_all;
+} tlb_batch_t;
+
+static inline void tlb_batch_init(tlb_batch_t* tlb, uint64_t start, uint64_t end) {
+    tlb->per_page = (end - start) / PAGE_SIZE <= VMM_INVLPG_MAX_PAGES;
+    tlb->flush_all = false;
+}
+
+static inline void tlb_batch_add(tlb_batch_t* tlb, uint64_t virt_addr) {
+    if (tlb->per_page) invlpg((void*)virt_addr);
+    else tlb->flush_all = true;
+}
+
+static inline void tlb_batch_finish(tlb_batch_t* tlb) {
+    if (tlb->flush_all) flush_tlb_all();
+}
+
+/* Map [virt_addr, virt_addr+size) -> [phys_addr, ...) with 4KB PTE flags.
+   Each page directory and page table is walked to once and filled in a
+   run; stretches where both addresses are 2MB aligned use 2MB pages, and a
+   page table they replace is freed. A 2MB page that already maps part of
+   the range identically is left alone, otherwise it is split first. */
+bool vmm_map_range(uint64_t virt_addr, uint64_t phys_addr, size_t size, uint64_t flags) {
+    uint64_t virt = virt_addr & ~0xFFFULL;
+    uint64_t phys = phys_addr & ~0xFFFULL;
+    uint64_t end = (virt_addr + size + 0xFFFULL) & ~0xFFFULL;
+    uint64_t* pdt = NULL;
+    bool ok = true;
+    tlb_batch_t tlb;
+    tlb_batch_init(&tlb, virt, end);
+
+    while (virt < end) {
+        if (pdt == NULL || (virt & (PDT_SPAN - 1)) == 0) {
+            pdt = get_pdt(virt, true);
+            if (!pdt) { ok = false; break; }
         }
-        serial_writestring("VMM: Attempted to map a 4KB page where a 2MB huge page exists. This is not supported.\n");
-        return false;
-    }
+        uint16_t pdt_index = (virt >> 21) & 0x1FF;
+        uint64_t pde = pdt[pdt_index];
 
-    uint64_t* pt = get_next_level_table(pdt, pdt_index, true);
-    if (!pt) return false;
+        if (!((virt | phys) & (HUGE_PAGE_SIZE - 1)) && end - virt >= HUGE_PAGE_SIZE) {
+            uint64_t new_pde = phys | pte_flags_to_pde(flags);
+            if ((pde & ~PAGE_ACCESSED_DIRTY) != new_pde) {
+                pdt[pdt_index] = new_pde;
+                if ((pde & PAGE_PRESENT) && !(pde & PAGE_HUGE)) {
+                    // The old table may have left 4KB translations anywhere in the range.
+                    tlb.flush_all = true;
+                    pmm_free_page((void*)(pde & ADDRESS_MASK));
+                } else if (pde & PAGE_PRESENT) {
+                    tlb_batch_add(&tlb, virt);
+                }
+            }
+            virt += HUGE_PAGE_SIZE;
+            phys += HUGE_PAGE_SIZE;
+            continue;
+        }
+
+        // 4KB pages up to the next 2MB boundary or the end of the range.
+        uint64_t chunk = HUGE_PAGE_SIZE - (virt & (HUGE_PAGE_SIZE - 1));
+        if (chunk > end - virt) chunk = end - virt;
+
+        uint64_t* pt;
+        if (pde & PAGE_HUGE) {
+            uint64_t huge_phys = (pde & HUGE_ADDRESS_MASK) + (virt & (HUGE_PAGE_SIZE - 1));
+            if (huge_phys == phys && (pde_flags_to_pte(pde) & PTE_ATTR_MASK) == (flags & PTE_ATTR_MASK)) {
+                virt += chunk;
+                phys += chunk;
+                continue;
+            }
+            pt = split_huge_entry(pdt, pdt_index, virt);
+        } else {
+            pt = get_next_level_table(pdt, pdt_index, true);
+        }
+        if (!pt) { ok = false; break; }
+
+        for (uint16_t i = (virt >> 12) & 0x1FF; chunk; i++, chunk -= PAGE_SIZE) {
+            uint64_t old = pt[i];
+            pt[i] = phys | flags;
+            if (old & PAGE_PRESENT) tlb_batch_add(&tlb, virt);
+            virt += PAGE_SIZE;
+            phys += PAGE_SIZE;
+        }
+    }
 
-    pt[pt_index] = phys_addr | flags;
-    invlpg((void*)virt_addr);
+    tlb_batch_finish(&tlb);
+    return ok;
+}
 
+static bool page_table_empty(const uint64_t* pt) {
+    for (int i = 0; i < 512; i++) {
+        if (pt[i] & PAGE_PRESENT) return false;
+    }
     return true;
 }
 
-/* Unmap one 4KB page at virt_addr. */
-void vmm_unmap_page(uint64_t virt_addr) {
-    uint64_t* pml4 = get_pml4();
-    uint16_t pml4_index = (virt_addr >> 39) & 0x1FF;
-    uint16_t pdpt_index = (virt_addr >> 30) & 0x1FF;
-    uint16_t pdt_index = (virt_addr >> 21) & 0x1FF;
-    uint16_t pt_index = (virt_addr >> 12) & 0x1FF;
+/* Unmap [virt_addr, virt_addr+size). Whole 2MB pages are dropped, partly
+   covered ones are split, and page tables left empty are freed. Unmapped
+   holes are skipped a page directory or page table at a time. With
+   free_frames, the physical pages behind the removed entries go back to the
+   PMM right away; nothing runs on this single core that could use a stale
+   translation before the flush at the end. */
+static void unmap_range(uint64_t virt_addr, size_t size, bool free_frames) {
+    uint64_t virt = virt_addr & ~0xFFFULL;
+    uint64_t end = (virt_addr + size + 0xFFFULL) & ~0xFFFULL;
+    tlb_batch_t tlb;
+    tlb_batch_init(&tlb, virt, end);
 
-    uint64_t* pdpt = get_next_level_table(pml4, pml4_index, false);
-    if (!pdpt) return;
+    while (virt < end) {
+        uint64_t* pdt = get_pdt(virt, false);
+        if (!pdt) {
+            virt = (virt + PDT_SPAN) & ~(PDT_SPAN - 1);
+            continue;
+        }
 
-    uint64_t* pdt = get_next_level_table(pdpt, pdpt_index, false);
-    if (!pdt) return;
+        uint64_t pdt_end = (virt + PDT_SPAN) & ~(PDT_SPAN - 1);
+        while (virt < end && virt < pdt_end) {
+            uint16_t pdt_index = (virt >> 21) & 0x1FF;
+            uint64_t pde = pdt[pdt_index];
+            uint64_t chunk = HUGE_PAGE_SIZE - (virt & (HUGE_PAGE_SIZE - 1));
+            if (chunk > end - virt) chunk = end - virt;
 
-    uint64_t* pt = get_next_level_table(pdt, pdt_index, false);
-    if (!pt) return;
+            if (!(pde & PAGE_PRESENT)) {
+                virt += chunk;
+                continue;
+            }
+            if (pde & PAGE_HUGE) {
+                if (chunk == HUGE_PAGE_SIZE) {
+                    pdt[pdt_index] = 0;
+                    tlb_batch_add(&tlb, virt);
+                    if (free_frames) pmm_free((void*)(pde & HUGE_ADDRESS_MASK), HUGE_PAGE_SIZE);
+                    virt += chunk;
+                    continue;
+                }
+                if (!split_huge_entry(pdt, pdt_index, virt)) {
+                    virt += chunk;
+                    continue;
+                }
+                pde = pdt[pdt_index];
+            }
 
-    pt[pt_index] = 0;
-    invlpg((void*)virt_addr);
+            uint64_t* pt = (uint64_t*)phys_to_virt(pde & ADDRESS_MASK);
+            for (uint16_t i = (virt >> 12) & 0x1FF; chunk; i++, chunk -= PAGE_SIZE) {
+                if (pt[i] & PAGE_PRESENT) {
+                    if (free_frames) pmm_free_page((void*)(pt[i] & ADDRESS_MASK));
+                    pt[i] = 0;
+                    tlb_batch_add(&tlb, virt);
+                }
+                virt += PAGE_SIZE;
+            }
+            if (page_table_empty(pt)) {
+                // Paging-structure caches may still point at the table.
+                pdt[pdt_index] = 0;
+                tlb.flush_all = true;
+                pmm_free_page((void*)(pde & ADDRESS_MASK));
+            }
+        }
+    }
+
+    tlb_batch_finish(&tlb);
+}
+
+void vmm_unmap_range(uint64_t virt_addr, size_t size) {
+    unmap_range(virt_addr, size, false);
+}
+
+/* Unmap a range backed by pages from pmm_alloc_page() and free them too. */
+void vmm_unmap_free_range(uint64_t virt_addr, size_t size) {
+    unmap_range(virt_addr, size, true);
+}
+
+/* Map one 2MB page at virt_addr -> phys_addr (both 2MB aligned). flags are
+   ordinary 4KB PTE flags. A page table previously covering the range is freed. */
+bool vmm_map_huge_page(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags) {
+    if ((virt_addr | phys_addr) & (HUGE_PAGE_SIZE - 1)) return false;
+    return vmm_map_range(virt_addr, phys_addr, HUGE_PAGE_SIZE, flags);
+}
+
+/* Map one 4KB page at virt_addr -> phys_addr with flags. */
+bool vmm_map_page(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags) {
+    return vmm_map_range(virt_addr, phys_addr, PAGE_SIZE, flags);
+}
+
+/* Unmap one 4KB page at virt_addr, splitting a 2MB page that covers it. */
+void vmm_unmap_page(uint64_t virt_addr) {
+    vmm_unmap_range(virt_addr, PAGE_SIZE);
 }
 
-/* Identity-map [phys_addr, phys_addr+size) using 4KB pages. */
+/* Identity-map [phys_addr, phys_addr+size): 2MB pages for every aligned
+   2MB stretch, 4KB pages for the edges. */
 bool vmm_identity_map_range(uint64_t phys_addr, size_t size, uint64_t flags) {
-    uint64_t aligned_start = phys_addr & ~0xFFFULL;
-    uint64_t aligned_end   = (phys_addr + size + 0xFFFULL) & ~0xFFFULL;
-    for (uint64_t addr = aligned_start; addr < aligned_end; addr += 0x1000) {
-        if (!vmm_map_page(addr, addr, flags)) {
-            return false;
-        }
+    return vmm_map_range(phys_addr, phys_addr, size, flags);
+}
+
+/* Identity-map [phys_addr, phys_addr+size) writable and write-combining.
+   Without PAT support this is an ordinary mapping. */
+bool vmm_map_range_wc(uint64_t phys_addr, size_t size) {
+    uint64_t flags = PAGE_PRESENT | PAGE_WRITABLE;
+    if (pat_enabled) flags |= PAGE_WRITE_COMBINING;
+    if (!vmm_identity_map_range(phys_addr, size, flags)) {
+        return false;
     }
+    // Lines cached under the old memory type must not linger.
+    wbinvd();
     return true;
 }
 
-/* Print CR3 address for debugging. */
-void vmm_init() {
+/* Load PAT_VALUE into the PAT MSR if the CPU has one (CPUID.1:EDX[16]). */
+static void vmm_init_pat(void) {
+    uint32_t a, b, c, d;
+    cpuid(1, 0, &a, &b, &c, &d);
+    if (!(d & (1u << 16))) {
+        serial_writestring("[Serial] VMM: PAT not supported, no write-combining.\n");
+        return;
+    }
+    wbinvd();
+    wrmsr(MSR_PAT, PAT_VALUE);
+    wbinvd();
+    flush_tlb_all();
+    pat_enabled = true;
+}
+
+/* 1GB pages are optional: CPUID.80000001h:EDX[26]. */
+static bool cpu_has_gb_pages(void) {
+    uint32_t a, b, c, d;
+    cpuid(0x80000000, 0, &a, &b, &c, &d);
+    if (a < 0x80000001) return false;
+    cpuid(0x80000001, 0, &a, &b, &c, &d);
+    return (d & (1u << 26)) != 0;
+}
+
+/* Map the whole pages of every RAM range in the memory map (available and
+   ACPI-reclaimable) below limit at PHYS_MAP_BASE + phys, write-back. Holes
+   such as MMIO and the framebuffer stay out, so the direct map never aliases
+   them with a different memory type. A gigabyte that is all RAM gets one 1GB
+   PDPT entry where the CPU supports it; vmm_map_range() covers the rest with
+   2MB pages where aligned and 4KB pages up to the hole boundaries. The tables
+   come from the identity-mapped low 4GB, and phys_to_virt() only switches
+   over once the whole map is in place. phys_map_size stops below the first
+   range that could not be mapped. */
+static void vmm_build_phys_map(struct multiboot2_tag_mmap* mmap_tag, uint64_t limit) {
+    bool gb_pages = cpu_has_gb_pages();
+    uint64_t flags = PAGE_PRESENT | PAGE_WRITABLE;
+    uint64_t* pml4 = get_pml4();
+    uint64_t top = 0;
+    uint64_t failed = limit;
+    uint64_t mapped = 0;
+
+    for (struct multiboot2_mmap_entry* mmap = mmap_tag->entries;
+         (uint8_t*)mmap < (uint8_t*)mmap_tag + mmap_tag->size;
+         mmap = (struct multiboot2_mmap_entry*)((uint8_t*)mmap + mmap_tag->entry_size)) {
+
+        if (mmap->type != MULTIBOOT2_MEMORY_AVAILABLE && mmap->type != MULTIBOOT2_MEMORY_ACPI_RECLAIMABLE) {
+            continue;
+        }
+        uint64_t start = (mmap->addr + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+        uint64_t end = (mmap->addr + mmap->len) & ~(uint64_t)(PAGE_SIZE - 1);
+        if (end > limit) end = limit;
+        while (start < end) {
+            uint64_t virt = PHYS_MAP_BASE + start;
+            uint64_t chunk = ((start + PDT_SPAN) & ~(PDT_SPAN - 1)) - start;
+            if (chunk > end - start) chunk = end - start;
+            if (gb_pages && chunk == PDT_SPAN) {
+                uint64_t* pdpt = get_next_level_table(pml4, (virt >> 39) & 0x1FF, true);
+                if (!pdpt) break;
+                pdpt[(virt >> 30) & 0x1FF] = start | pte_flags_to_pde(flags);
+            } else if (!vmm_map_range(virt, start, chunk, flags)) {
+                break;
+            }
+            start += chunk;
+            mapped += chunk;
+        }
+        if (start < end && start < failed) failed = start;
+        if (end > top) top = end;
+    }
+    phys_map_size = top < failed ? top : failed;
+
+    serial_writestring("[Serial] VMM: direct map of ");
+    serial_writedec(mapped >> 20);
+    serial_writestring(gb_pages ? " MiB of RAM (1GB pages where possible) at " : " MiB of RAM at ");
+    serial_writehex(PHYS_MAP_BASE);
+    serial_writestring(", up to ");
+    serial_writehex(phys_map_size);
+    serial_writestring("\n");
+}
+
+/* Program the PAT, build the direct map of RAM and print CR3 address for debugging. */
+void vmm_init(struct multiboot2_tag_mmap* mmap_tag) {
+    vmm_init_pat();
+
+    pmm_info_t pinfo;
+    pmm_get_info(&pinfo);
+    vmm_build_phys_map(mmap_tag, (uint64_t)pinfo.total_pages * PAGE_SIZE);
+
     uint64_t cr3;
     asm volatile("mov %%cr3, %0" : "=r"(cr3));
     serial_writestring("[Serial] VMM Initialized, CR3 is at: ");
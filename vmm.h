@@ -8,13 +8,33 @@
 #define PAGE_PRESENT (1 << 0)
 #define PAGE_WRITABLE (1 << 1)
 #define PAGE_USER (1 << 2)
+#define PAGE_WRITE_THROUGH (1 << 3)
+#define PAGE_CACHE_DISABLE (1 << 4)
+// vmm_init() programs PAT entry 1 (PWT only) as write-combining.
+#define PAGE_WRITE_COMBINING PAGE_WRITE_THROUGH
 
-void vmm_init();
+struct multiboot2_tag_mmap;
+
+// Programs the PAT and maps the RAM ranges of mmap_tag at PHYS_MAP_BASE (see mem.h).
+void vmm_init(struct multiboot2_tag_mmap* mmap_tag);
 bool vmm_map_page(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags);
 void vmm_unmap_page(uint64_t virt_addr);
 uint64_t* vmm_get_pml4();
-// Map [phys, phys+size) to the same virtual addresses with given flags.
+// Map/unmap a whole range, walking each page table once. Aligned 2MB stretches
+// use 2MB pages; unmapping frees page tables that end up empty.
+bool vmm_map_range(uint64_t virt_addr, uint64_t phys_addr, size_t size, uint64_t flags);
+void vmm_unmap_range(uint64_t virt_addr, size_t size);
+// Same, also returning the physical pages that were mapped there to the PMM.
+void vmm_unmap_free_range(uint64_t virt_addr, size_t size);
+// Map one 2MB page; both addresses must be 2MB aligned. flags are 4KB-style.
+bool vmm_map_huge_page(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags);
+// Break the 2MB page covering virt_addr into 4KB pages with the same flags.
+bool vmm_split_huge_page(uint64_t virt_addr);
+// Map [phys, phys+size) to the same virtual addresses with given flags,
+// using 2MB pages wherever the range allows.
 // Returns true on success, false on any allocation failure.
 bool vmm_identity_map_range(uint64_t phys_addr, size_t size, uint64_t flags);
+// Identity-map a range writable and write-combining (for framebuffers).
+bool vmm_map_range_wc(uint64_t phys_addr, size_t size);
 
 #endif 
\ No newline at end of file